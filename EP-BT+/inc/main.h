@@ -22,7 +22,10 @@
  * Application parameters
  *
  * Packet Rate:
- *     To configure output packet rate, configure RTC_DELAY
+ *     To configure output packet rate, configure PACKET_RATE_HZ
+ *     Any integer rate works, the RTC scheduler dithers whole ~61 us ticks so the
+ *     average rate is exact. Change it at runtime with RTC_Scheduler_SetRateHz()
+ *     or RTC_Scheduler_SetPeriodUS().
  *
  * BLE Bit Rate:
  *     Configure BLE_PHY to 125, 500, 1000, or 2000 for
@@ -38,6 +41,8 @@
  *     Enable periodic blinking of onboard LED by uncommenting LED_BLINK
  *     LED turns on every LED_ON_THRESHOLD packets
  *     LED then turns off after LED_OFF_THRESHOLD packets
+ *     If imu_init() fails the LED toggles every IMU_FAULT_BLINK_US instead and no packets
+ *     are sent (USE_IMU).
  *
  * Power Saving Options:
  *     IMU_POWER_OFF: turns off the IMU between packets
@@ -45,12 +50,70 @@
  *     ENTER_DEEPSTOP: CPU enters DEEPSTOP mode between packets (otherwise, enters CPU HALT)
  *         Saves power, but takes time. Not possible for high packet rates.
  *
+ * IMU Read:
+ *     IMU_DMA_READ: read the IMU with SPI2 on DMA channels 1/2 while the packet is on air
+ *         and sleep until both complete, instead of a blocking read after the TX starts.
+ *         Not with IMU_POWER_OFF, which needs the blocking SPI calls around the read. A read
+ *         that finds no new sample waits for the next data ready pulse on INT1.
+ *     IMU_DRDY: the IMU data ready pulse starts a DMA read of each new sample into a double
+ *         buffer, and the loop copies the newest one. The TX loop never waits for the sensor
+ *         and the packet carries a sample at most one ODR period old. Uses DMA channels 1/2.
+ *         Not with ENTER_DEEPSTOP, which would stop a latch read halfway.
+ *     IMU_FIFO: let the IMU batch gyro/accel into its FIFO at IMU_FIFO_ODR_HZ and wake every
+ *         IMU_FIFO_BATCH samples instead of every packet. Each wake drains the FIFO and sends
+ *         the samples back to back, IMU_FIFO_SAMPLES_PER_PACKET per packet. PACKET_RATE_HZ
+ *         is not used, the wake period follows from the ODR and the batch size.
+ *         FIFO packet AdvData: [1..2] sequence, [3] sample count, [4..5] index of the first
+ *         sample since start, then per sample gyro xyz, accel xyz (12 bytes). Timestamps
+ *         are index / ODR on the receiver.
+ *     IMU_CODEC: with IMU_FIFO, compress each batch with jv_imu_codec (keyframe, then
+ *         zigzag deltas at the minimum width per axis) into AdvData[3..30]. The keyframe
+ *         timestamp is the 16 bit sample index, no temperature is sent. The host test
+ *         measures 3.57 samples per packet at rest, 2.38 in motion and 2.00 for full scale
+ *         noise, against 2 without the codec. Decode with jv_imu_codec_decode().
+ *     IMU_POLICY: pick power cycling, a matched ODR or FIFO batching at runtime for
+ *         PACKET_RATE_HZ with jv_imu_policy, whichever the model says is cheapest with the
+ *         sample no older than IMU_MAX_LATENCY_US at TX. Single sample packets keep the
+ *         default layout with AdvData[3] = 0, FIFO batches use the IMU_FIFO layout. FIFO
+ *         batching sends every sample at an ODR of at least 2 * PACKET_RATE_HZ, so up to
+ *         twice PACKET_RATE_HZ packets per second go out (6.25 at the lowest ODR), see
+ *         jv_imu_policy.h. The mode is planned once at startup. If no mode meets the rate the
+ *         LED toggles every IMU_FAULT_BLINK_US and no packets are sent.
+ *     IMU_LOW_LATENCY: read the IMU right after each wake and send that sample in the same
+ *         period, instead of sending the sample read in the previous one. TX starts a fixed
+ *         budget after the IMU read, the measured encode cost plus IMU_TX_MARGIN_US, and
+ *         AdvData[22..23] carries the delta in us from the DRDY pulse of the sample to TX,
+ *         so the receiver can measure sample-to-air and end-to-end latency. The budget
+ *         follows the worst encode cost. A packet that overruns it (always the first one),
+ *         or whose sample cannot be matched to its pulse, carries IMU_DELTA_UNKNOWN.
+ *         Not with IMU_ACTIVITY, both use INT1.
+ *     IMU_ACTIVITY: send at PACKET_RATE_HZ while the IMU reports motion and at
+ *         IMU_IDLE_RATE_HZ while it is still. The IMU goes active after IMU_WAKE_DUR + 1
+ *         samples above IMU_WAKE_THS (15.6 mg LSB) and inactive after IMU_SLEEP_DUR * 512
+ *         samples below it, so short pauses keep the fast rate. The transition pulse on INT1
+ *         ends the slow period early and wakes DEEPSTOP, so a motion burst is sent from
+ *         its start. While still the gyro is off, the accel runs at 12.5 Hz and the packets
+ *         carry a zero angular rate. Not with IMU_LOW_LATENCY, its data ready pulses on
+ *         INT1 would end every period early.
+ *
+ * Backscatter DMA:
+ *     BSC_DMA_KEEP_ARMED: keep SPI1/DMA clocked and configured between packets and only
+ *         reload the transfer count (SPI_DMA_Retrigger). Cuts wake-to-first-bit latency,
+ *         compare with JV_TRACE_WAKE_TO_TX. Costs the idle SPI1/DMA clock current.
+ *     BSC_ASYNC_TX: queue each packet with SPI_DMA_Submit() and encode the next one into a
+ *         second buffer while it is on air, instead of blocking until the DMA completes.
+ *         Doubles the upscaled buffer RAM.
+ *
+ * Debug Options:
+ *     JV_TRACE: record per-stage cycle counts (PDU build, CRC/whiten, FEC, upscale,
+ *         DMA, IMU read, RTC wait) into a .noinit trace buffer, see jv_trace.h
+ *
  */
 
 /**********************/
 /* User configuration */
 /**********************/
-#define RTC_DELAY            RTC_DELAY_120HZ
+#define PACKET_RATE_HZ       120
 #define BLE_CHANNEL   0
 #define BLE_PHY 1000 // 125, 500, 1000, or 2000
 #define LED_BLINK            true
@@ -58,50 +121,159 @@
 #define LED_OFF_THRESHOLD    2
 //#define USE_IMU              true
 // #define IMU_POWER_OFF        true
+// #define IMU_DMA_READ         true
+// #define IMU_DRDY             true
+// #define IMU_FIFO             true
+#define IMU_FIFO_ODR_HZ      417 // 52, 104, 208, 417, 833, 1667, 3333, or 6667
+#define IMU_FIFO_BATCH       4   // samples per wake
+// #define IMU_CODEC            true
+// #define IMU_POLICY           true
+#define IMU_MAX_LATENCY_US   20000
+// #define IMU_LOW_LATENCY      true
+#define IMU_TX_MARGIN_US     20
+#define IMU_READ_US          40     // imu_get_packet_data(), a DRDY pulse this close may be mid-read
+#define IMU_DELTA_UNKNOWN    0xFFFF // AdvData[22..23] when the sample-to-TX delta is not known
+// #define IMU_ACTIVITY         true
+#define IMU_IDLE_RATE_HZ     1
+#define IMU_WAKE_THS         4 // 62 mg
+#define IMU_WAKE_DUR         1
+#define IMU_SLEEP_DUR        2
 // #define ENTER_DEEPSTOP       true
+// #define BSC_DMA_KEEP_ARMED   true
+// #define BSC_ASYNC_TX         true
+// #define JV_TRACE             true
 
 /* Other application defines */
-#define RTC_DELAY_1HZ     16384
-#define RTC_DELAY_10HZ    1638
-#define RTC_DELAY_60HZ    273
-#define RTC_DELAY_90HZ    182
-#define RTC_DELAY_120HZ   137
-#define RTC_DELAY_144HZ   114
-#define RTC_DELAY_200HZ   82
-#define RTC_DELAY_240HZ   68
-#define RTC_DELAY_360HZ   46
-#define RTC_DELAY_480HZ   34
-#define RTC_DELAY_720HZ   23
-#define RTC_DELAY_1000HZ  16
-#define RTC_DELAY_2000HZ  8
-#define RTC_DELAY_300kbps 13 // define for 300 kbps benchmarking
-
-#if defined IMU_POWER_OFF && RTC_DELAY <= RTC_DELAY_480HZ
+#define IMU_FAULT_BLINK_US   50000 // LED toggle period when imu_init() fails, jv_delayUS() range
+
+#if PACKET_RATE_HZ < 1 || PACKET_RATE_HZ > 8192
+#error "PACKET_RATE_HZ must be 1 to 8192 Hz, see RTC_Scheduler_SetRateHz()"
+#endif
+
+#if defined IMU_ACTIVITY && (IMU_IDLE_RATE_HZ < 1 || IMU_IDLE_RATE_HZ > PACKET_RATE_HZ)
+#error "IMU_IDLE_RATE_HZ must be 1 Hz to PACKET_RATE_HZ"
+#endif
+
+#if defined IMU_POWER_OFF && PACKET_RATE_HZ > 360
 #error "Max data rate in IMU_POWER_OFF is 360 Hz"
 #endif
 
-#ifdef IMU_POWER_OFF
+#if defined IMU_DMA_READ && defined IMU_POWER_OFF
+#error "IMU_DMA_READ does not support IMU_POWER_OFF"
+#endif
+
+#if defined IMU_DRDY && (defined IMU_POWER_OFF || defined IMU_DMA_READ || defined IMU_FIFO || defined ENTER_DEEPSTOP)
+#error "IMU_DRDY owns the IMU SPI, it does not support IMU_POWER_OFF, IMU_DMA_READ, IMU_FIFO or ENTER_DEEPSTOP"
+#endif
+
+#ifdef IMU_FIFO
+#if !defined USE_IMU || defined IMU_POWER_OFF || defined IMU_DMA_READ || defined BSC_ASYNC_TX
+#error "IMU_FIFO needs USE_IMU, and does not support IMU_POWER_OFF, IMU_DMA_READ or BSC_ASYNC_TX"
+#endif
+#define IMU_FIFO_SAMPLES_PER_PACKET 2                                    // 31 byte AdvData, 6 byte header
+#define IMU_FIFO_MAX_SAMPLES        (2 * IMU_FIFO_BATCH)                 // drains the IMU/RTC clock drift
+#define IMU_FIFO_WAKE_PERIOD_US     (IMU_FIFO_BATCH * 1000000UL / IMU_FIFO_ODR_HZ)
+#if IMU_FIFO_WAKE_PERIOD_US < 123 || IMU_FIFO_WAKE_PERIOD_US > 3999938
+#error "IMU_FIFO_BATCH samples at IMU_FIFO_ODR_HZ must take 123 us to 4 s, see RTC_Scheduler_SetPeriodUS()"
+#endif
+#endif
+
+#ifdef IMU_POLICY
+#if !defined USE_IMU || defined IMU_POWER_OFF || defined IMU_DMA_READ || defined IMU_DRDY || defined IMU_FIFO || defined BSC_ASYNC_TX
+#error "IMU_POLICY needs USE_IMU, and does not support IMU_POWER_OFF, IMU_DMA_READ, IMU_DRDY, IMU_FIFO or BSC_ASYNC_TX"
+#endif
+#define IMU_FIFO_SAMPLES_PER_PACKET 2
+#define IMU_FIFO_MAX_SAMPLES        (2 * JV_IMU_POLICY_MAX_BATCH)
+#endif
+
+#ifdef IMU_LOW_LATENCY
+#if !defined USE_IMU || defined IMU_POWER_OFF || defined IMU_DMA_READ || defined IMU_DRDY || defined IMU_FIFO || defined IMU_POLICY || defined IMU_ACTIVITY || defined BSC_ASYNC_TX || defined ENTER_DEEPSTOP
+#error "IMU_LOW_LATENCY needs USE_IMU, and does not support IMU_POWER_OFF, IMU_DMA_READ, IMU_DRDY, IMU_FIFO, IMU_POLICY, IMU_ACTIVITY, BSC_ASYNC_TX or ENTER_DEEPSTOP"
+#endif
+#endif
+
+#ifdef IMU_ACTIVITY
+#if !defined USE_IMU || defined IMU_POWER_OFF || defined IMU_DMA_READ || defined IMU_DRDY || defined IMU_FIFO || defined IMU_POLICY || defined IMU_LOW_LATENCY
+#error "IMU_ACTIVITY needs USE_IMU, and does not support IMU_POWER_OFF, IMU_DMA_READ, IMU_DRDY, IMU_FIFO, IMU_POLICY or IMU_LOW_LATENCY"
+#endif
+#endif
+
+#if defined IMU_CODEC && !defined IMU_FIFO
+#error "IMU_CODEC needs IMU_FIFO"
+#endif
+
+#if defined IMU_FIFO
+#if IMU_FIFO_ODR_HZ == 52
+#define XL_ODR LSM6DSO32_XL_ODR_52Hz_LOW_PW
+#define GY_ODR LSM6DSO32_GY_ODR_52Hz_LOW_PW
+#define XL_BDR LSM6DSO32_XL_BATCHED_AT_52Hz
+#define GY_BDR LSM6DSO32_GY_BATCHED_AT_52Hz
+#elif IMU_FIFO_ODR_HZ == 104
+#define XL_ODR LSM6DSO32_XL_ODR_104Hz_NORMAL_MD
+#define GY_ODR LSM6DSO32_GY_ODR_104Hz_NORMAL_MD
+#define XL_BDR LSM6DSO32_XL_BATCHED_AT_104Hz
+#define GY_BDR LSM6DSO32_GY_BATCHED_AT_104Hz
+#elif IMU_FIFO_ODR_HZ == 208
+#define XL_ODR LSM6DSO32_XL_ODR_208Hz_NORMAL_MD
+#define GY_ODR LSM6DSO32_GY_ODR_208Hz_NORMAL_MD
+#define XL_BDR LSM6DSO32_XL_BATCHED_AT_208Hz
+#define GY_BDR LSM6DSO32_GY_BATCHED_AT_208Hz
+#elif IMU_FIFO_ODR_HZ == 417
+#define XL_ODR LSM6DSO32_XL_ODR_417Hz_HIGH_PERF
+#define GY_ODR LSM6DSO32_GY_ODR_417Hz_HIGH_PERF
+#define XL_BDR LSM6DSO32_XL_BATCHED_AT_417Hz
+#define GY_BDR LSM6DSO32_GY_BATCHED_AT_417Hz
+#elif IMU_FIFO_ODR_HZ == 833
+#define XL_ODR LSM6DSO32_XL_ODR_833Hz_HIGH_PERF
+#define GY_ODR LSM6DSO32_GY_ODR_833Hz_HIGH_PERF
+#define XL_BDR LSM6DSO32_XL_BATCHED_AT_833Hz
+#define GY_BDR LSM6DSO32_GY_BATCHED_AT_833Hz
+#elif IMU_FIFO_ODR_HZ == 1667
+#define XL_ODR LSM6DSO32_XL_ODR_1667Hz_HIGH_PERF
+#define GY_ODR LSM6DSO32_GY_ODR_1667Hz_HIGH_PERF
+#define XL_BDR LSM6DSO32_XL_BATCHED_AT_1667Hz
+#define GY_BDR LSM6DSO32_GY_BATCHED_AT_1667Hz
+#elif IMU_FIFO_ODR_HZ == 3333
+#define XL_ODR LSM6DSO32_XL_ODR_3333Hz_HIGH_PERF
+#define GY_ODR LSM6DSO32_GY_ODR_3333Hz_HIGH_PERF
+#define XL_BDR LSM6DSO32_XL_BATCHED_AT_3333Hz
+#define GY_BDR LSM6DSO32_GY_BATCHED_AT_3333Hz
+#elif IMU_FIFO_ODR_HZ == 6667
+#define XL_ODR LSM6DSO32_XL_ODR_6667Hz_HIGH_PERF
+#define GY_ODR LSM6DSO32_GY_ODR_6667Hz_HIGH_PERF
+#define XL_BDR LSM6DSO32_XL_BATCHED_AT_6667Hz
+#define GY_BDR LSM6DSO32_GY_BATCHED_AT_6667Hz
+#else
+#error "Invalid IMU_FIFO_ODR_HZ" XSTR(IMU_FIFO_ODR_HZ)
+#endif
+#elif defined IMU_POWER_OFF
 #define XL_ODR LSM6DSO32_XL_ODR_6667Hz_HIGH_PERF
 #define GY_ODR LSM6DSO32_GY_ODR_6667Hz_HIGH_PERF
 #else
-#if RTC_DELAY == RTC_DELAY_1HZ || RTC_DELAY == RTC_DELAY_10HZ
+#if PACKET_RATE_HZ <= 50
 #define XL_ODR LSM6DSO32_XL_ODR_52Hz_LOW_PW
 #define GY_ODR LSM6DSO32_GY_ODR_52Hz_LOW_PW
-#elif RTC_DELAY == RTC_DELAY_60HZ || RTC_DELAY == RTC_DELAY_90HZ
+#define IMU_ODR_PERIOD_US 19231
+#elif PACKET_RATE_HZ <= 100
 #define XL_ODR LSM6DSO32_XL_ODR_104Hz_NORMAL_MD
 #define GY_ODR LSM6DSO32_GY_ODR_104Hz_NORMAL_MD
-#elif RTC_DELAY == RTC_DELAY_120HZ || RTC_DELAY == RTC_DELAY_144HZ || RTC_DELAY == RTC_DELAY_200HZ
+#define IMU_ODR_PERIOD_US 9615
+#elif PACKET_RATE_HZ <= 200
 #define XL_ODR LSM6DSO32_XL_ODR_208Hz_NORMAL_MD
 #define GY_ODR LSM6DSO32_GY_ODR_208Hz_NORMAL_MD
-#elif RTC_DELAY == RTC_DELAY_240HZ || RTC_DELAY == RTC_DELAY_360HZ
+#define IMU_ODR_PERIOD_US 4808
+#elif PACKET_RATE_HZ <= 400
 #define XL_ODR LSM6DSO32_XL_ODR_417Hz_HIGH_PERF
 #define GY_ODR LSM6DSO32_GY_ODR_417Hz_HIGH_PERF
-#elif RTC_DELAY == RTC_DELAY_480HZ || RTC_DELAY == RTC_DELAY_720HZ
+#define IMU_ODR_PERIOD_US 2398
+#elif PACKET_RATE_HZ <= 800
 #define XL_ODR LSM6DSO32_XL_ODR_833Hz_HIGH_PERF
 #define GY_ODR LSM6DSO32_GY_ODR_833Hz_HIGH_PERF
+#define IMU_ODR_PERIOD_US 1200
 #else
 #define XL_ODR LSM6DSO32_XL_ODR_3333Hz_HIGH_PERF
 #define GY_ODR LSM6DSO32_GY_ODR_3333Hz_HIGH_PERF
+#define IMU_ODR_PERIOD_US 300
 #endif
 #endif
 
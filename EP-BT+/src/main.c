@@ -16,26 +16,31 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include "rf_driver_hal.h"
 #include "main.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_spi_bsc.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_rtc.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_gpio.h"
+#include "../lib/jv_BlueNRG-LP_lib/jv_delayUS.h"
+#include "../lib/jv_BlueNRG-LP_lib/jv_trace.h"
 #include "../lib/jv_LSM6DSO32_lib/jv_imu.h"
+#include "../lib/jv_LSM6DSO32_lib/jv_imu_codec.h"
+#include "../lib/jv_LSM6DSO32_lib/jv_imu_policy.h"
 #include "../lib/jv_bt+packet_lib/jv_bt+packet.h"
 #include "../lib/jv_bt+packet_lib/jv_bt+bsc.h"
 
 /* IMU SPI communication */
 SPI_HandleTypeDef hspiMaster;
-__attribute((aligned(4))) uint8_t aTxBuffer[32];                // Buffer used for transmission;
-uint8_t ubNbDataToTransmit = sizeof(aTxBuffer);                 // Data length to transmit
-__attribute((aligned(4))) uint8_t aRxBuffer[sizeof(aTxBuffer)]; // Buffer used for reception
 
 /* flags for SPI, RTC, IMU interrupts */
 volatile uint8_t data_ready = 0;
 
 /* BLE packet buffers */
-#ifdef USE_IMU
+#if defined IMU_FIFO || defined IMU_POLICY
+uint8_t AdvA[] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc};
+uint8_t AdvData[MAX_ADVERTISING_DATA_SIZE];
+#elif defined USE_IMU
 uint8_t AdvA[] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc};
 uint8_t AdvData[24];
 #else
@@ -51,8 +56,219 @@ jv_ble_packet packet;
 __attribute((aligned(4))) uint8_t coded_buf[1000];
 size_t coded_len;
 
+#ifdef BSC_ASYNC_TX
+uint32_t packet_upscaled_pool[2][2500];               // one buffer on air, one being encoded
+uint32_t *packet_upscaled = packet_upscaled_pool[0];
+#else
 uint32_t packet_upscaled[2500];
+#endif
 uint32_t upscaled_length;
+uint16_t count = 0; // sequence number
+
+#ifdef IMU_POLICY
+stmdev_ctx_t dev_ctx;
+int32_t result = 0;
+jv_imu_plan_t imu_plan;
+#endif
+
+#if defined IMU_FIFO || defined IMU_POLICY
+uint8_t fifo_samples[IMU_FIFO_MAX_SAMPLES * IMU_FIFO_SAMPLE_SIZE];
+uint16_t fifo_count;
+uint16_t fifo_index = 0; // samples sent since start
+#ifdef IMU_CODEC
+jv_imu_sample_t codec_samples[IMU_FIFO_MAX_SAMPLES];
+#endif
+#endif
+
+#ifdef IMU_LOW_LATENCY
+uint32_t tx_budget_us = 0; // IMU read to TX start, grows to the measured encode cost
+
+/**
+ * @brief Sample-to-TX delta for AdvData[22..23], dated from the DRDY pulse of the sample
+ *
+ * @param t_read jv_timeUS() at the end of imu_get_packet_data()
+ * @param t_tx Planned TX start
+ * @return uint16_t delta in us, IMU_DELTA_UNKNOWN if the pulse may not belong to the sample
+ */
+static uint16_t sample_to_tx_us(uint32_t t_read, uint32_t t_tx)
+{
+    uint32_t t_drdy;
+
+    if (!imu_drdy_time(&t_drdy))
+        return IMU_DELTA_UNKNOWN; // no pulse yet
+    if (t_read - t_drdy < IMU_READ_US)
+        return IMU_DELTA_UNKNOWN; // during the read, the sample may be the one before
+    if (t_read - t_drdy > IMU_ODR_PERIOD_US + IMU_ODR_PERIOD_US / 16)
+        return IMU_DELTA_UNKNOWN; // a newer pulse was missed, 1/16 for the ODR tolerance
+    if (t_tx - t_drdy >= IMU_DELTA_UNKNOWN)
+        return IMU_DELTA_UNKNOWN;
+    return (uint16_t)(t_tx - t_drdy);
+}
+#endif
+
+#if defined IMU_FIFO || defined IMU_POLICY || defined IMU_LOW_LATENCY
+/**
+ * @brief Build and encode AdvData into packet_upscaled
+ *
+ */
+static void encode_packet_data(void)
+{
+    JV_TRACE_BEGIN(JV_TRACE_PDU_BUILD);
+    create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA) / sizeof(AdvA[0]), AdvData, sizeof(AdvData) / sizeof(AdvData[0]));
+    JV_TRACE_END(JV_TRACE_PDU_BUILD);
+    JV_TRACE_BEGIN(JV_TRACE_CRC_WHITEN);
+    update_advertising_packet(&packet, &pdu);
+    JV_TRACE_END(JV_TRACE_CRC_WHITEN);
+#ifdef BLE_CODED
+    JV_TRACE_BEGIN(JV_TRACE_FEC);
+    coded_len = encode_packet(coded_buf, &packet);
+    JV_TRACE_END(JV_TRACE_FEC);
+    JV_TRACE_BEGIN(JV_TRACE_UPSCALE);
+    upscaled_length = jv_bsc_upscale(packet_upscaled, coded_buf, coded_len);
+    JV_TRACE_END(JV_TRACE_UPSCALE);
+#else
+    JV_TRACE_BEGIN(JV_TRACE_UPSCALE);
+    upscaled_length = jv_bsc_upscale(packet_upscaled, packet.whitened_packet, packet.packet_len);
+    JV_TRACE_END(JV_TRACE_UPSCALE);
+#endif
+}
+
+/**
+ * @brief Backscatter packet_upscaled, blocking until the DMA completes
+ *
+ */
+static void transmit_packet(void)
+{
+    JV_TRACE_BEGIN(JV_TRACE_DMA_START);
+#ifdef BSC_DMA_KEEP_ARMED
+    SPI_DMA_Retrigger(upscaled_length);
+#else
+    SPI_DMA_Reinit((uint32_t)packet_upscaled, upscaled_length);
+    SPI_DMA_Activate();
+#endif
+    JV_TRACE_END(JV_TRACE_DMA_START);
+    while (!DMA_SPI_TransmitCompleted())
+    {
+        __WFE();
+    }
+#ifndef BSC_DMA_KEEP_ARMED
+    SPI_DMA_Uninit();
+#endif
+}
+
+/**
+ * @brief Build, encode and backscatter AdvData, blocking until the DMA completes
+ *
+ */
+static void send_packet(void)
+{
+    encode_packet_data();
+    transmit_packet();
+}
+
+#ifdef USE_IMU
+/**
+ * @brief No IMU on the bus, or no IMU mode for the packet rate: blink the LED fast
+ *        instead of sending packets without data
+ *
+ */
+static void imu_fault(void)
+{
+    while (1)
+    {
+        led_toggle();
+        jv_delayUS(IMU_FAULT_BLINK_US);
+    }
+}
+#endif
+
+/**
+ * @brief Put the sequence number in AdvData and blink the LED
+ *
+ */
+static void next_sequence(void)
+{
+    AdvData[1] = (uint8_t)count;
+    AdvData[2] = (uint8_t)(count >> 8);
+    count++;
+
+#ifdef LED_BLINK
+    if (count % LED_ON_THRESHOLD == 0)
+        led_on();
+    else if (count % LED_ON_THRESHOLD == LED_OFF_THRESHOLD)
+        led_off();
+#endif
+}
+
+#if (defined IMU_FIFO || defined IMU_POLICY) && !defined IMU_CODEC
+/**
+ * @brief Send the drained FIFO samples back to back, IMU_FIFO_SAMPLES_PER_PACKET per packet
+ *
+ */
+static void send_fifo_samples(void)
+{
+    for (uint16_t i = 0; i < fifo_count; i += IMU_FIFO_SAMPLES_PER_PACKET)
+    {
+        uint8_t n = (fifo_count - i < IMU_FIFO_SAMPLES_PER_PACKET) ? fifo_count - i : IMU_FIFO_SAMPLES_PER_PACKET;
+
+        next_sequence();
+        AdvData[3] = n;
+        AdvData[4] = (uint8_t)fifo_index;
+        AdvData[5] = (uint8_t)(fifo_index >> 8);
+        memcpy(&AdvData[6], &fifo_samples[i * IMU_FIFO_SAMPLE_SIZE], n * IMU_FIFO_SAMPLE_SIZE);
+        fifo_index += n;
+        send_packet();
+    }
+}
+#endif
+#endif
+
+#ifdef IMU_ACTIVITY
+static bool imu_active = true; // PACKET_RATE_HZ until the IMU reports inactivity
+
+/**
+ * @brief Follow the IMU activity state with the packet rate
+ *
+ * Going active restarts the scheduler, so the first packet of a motion burst
+ * goes out now instead of at the end of the slow period.
+ *
+ * @param dev_ctx Device handle
+ * @return int32_t 0 if successful, else -1
+ */
+static int32_t follow_activity(stmdev_ctx_t *dev_ctx)
+{
+    bool active;
+    int32_t result = imu_activity_get(dev_ctx, &active);
+
+    if (result == 0 && active != imu_active)
+    {
+        imu_active = active;
+        RTC_Scheduler_SetRateHz(active ? PACKET_RATE_HZ : IMU_IDLE_RATE_HZ);
+        if (active)
+            RTC_Scheduler_Start();
+    }
+    return result;
+}
+#endif
+
+#ifdef IMU_POLICY
+/**
+ * @brief Let the IMU policy pick the cheapest mode for a packet rate and follow it
+ *
+ * Called once at startup, EP-BT+ has no input that changes the rate.
+ *
+ * @param hz Packet rate
+ * @return int32_t 0 if successful, -1 if no mode meets the rate within IMU_MAX_LATENCY_US
+ *         or the scheduler cannot run at its wake period
+ */
+static int32_t set_packet_rate(uint32_t hz)
+{
+    if (jv_imu_policy_plan(hz, IMU_MAX_LATENCY_US, &imu_plan) != 0)
+        return -1;
+    result |= jv_imu_policy_apply(&dev_ctx, &imu_plan);
+    return RTC_Scheduler_SetPeriodUS(imu_plan.wake_period_us);
+}
+#endif
 
 /**
  * @brief Main function
@@ -73,14 +289,30 @@ int main(void)
 #ifdef USE_IMU
     HAL_Init();
     MX_SPI_MASTER_Init();
+#ifndef IMU_POLICY
     stmdev_ctx_t dev_ctx;
     int32_t result = 0;
+#endif
     dev_ctx.write_reg = platform_write;
     dev_ctx.read_reg = platform_read;
     dev_ctx.handle = &hspiMaster;
-    result |= imu_init(&dev_ctx);
+    jv_delayUS_Init(); // times the imu_init() polling
+    if (imu_init(&dev_ctx) != 0)
+        imu_fault(); // the IMU reads below would never see data
     result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
-#ifdef IMU_POWER_OFF
+#ifdef IMU_FIFO
+    result |= imu_fifo_init(&dev_ctx, 2 * IMU_FIFO_BATCH);
+#endif
+#ifdef IMU_DMA_READ
+    imu_dma_init();
+#endif
+#ifdef IMU_DRDY
+    imu_drdy_latch_init();
+#endif
+#ifdef IMU_ACTIVITY
+    result |= imu_activity_init(&dev_ctx, IMU_WAKE_THS, IMU_WAKE_DUR, IMU_SLEEP_DUR);
+#endif
+#if defined IMU_POWER_OFF || defined IMU_ACTIVITY || defined IMU_LOW_LATENCY
     imu_interrupt_init();
     imu_interrupt_enable();
 #endif
@@ -106,17 +338,120 @@ int main(void)
     WakeupSourceConfig_TypeDef wakeupIO;
     PowerSaveLevels stopLevel;
     wakeupIO.RTC_enable = 1;
+#ifdef IMU_ACTIVITY
+    wakeupIO.IO_Mask_High_polarity = WAKEUP_PB3; // IMU INT1, sleep change
+    wakeupIO.IO_Mask_Low_polarity = NO_WAKEUP_SOURCE;
 #endif
+#endif
+
+    /* stage tracing, after HAL_Init() which starts the SysTick tick */
+    JV_TRACE_INIT();
 
     /* start timer */
     RTC_WakeupInit();
-    SetRTC_WakeupTimeout(RTC_DELAY);
+    jv_timeUS_Init();
+#if defined IMU_POLICY
+    if (set_packet_rate(PACKET_RATE_HZ) != 0)
+        imu_fault();
+#elif defined IMU_FIFO
+    RTC_Scheduler_SetPeriodUS(IMU_FIFO_WAKE_PERIOD_US);
+#else
+    RTC_Scheduler_SetRateHz(PACKET_RATE_HZ);
+#endif
+    RTC_Scheduler_Start();
 
     /* infinite program loop */
-    uint16_t count = 0;
-
     while (1)
     {
+#if defined IMU_POLICY
+        JV_TRACE_END(JV_TRACE_WAKE_TO_TX);
+
+        /* sample the way the policy chose for this rate */
+        JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
+        if (imu_plan.mode == JV_IMU_MODE_FIFO_BATCH)
+            result |= imu_fifo_read(&dev_ctx, fifo_samples, IMU_FIFO_MAX_SAMPLES, &fifo_count);
+        else
+            result |= jv_imu_policy_read(&dev_ctx, &imu_plan, (uint16_t *)(&AdvData[4]));
+        JV_TRACE_END(JV_TRACE_IMU_READ);
+
+        if (imu_plan.mode == JV_IMU_MODE_FIFO_BATCH)
+        {
+            send_fifo_samples();
+        }
+        else
+        {
+            next_sequence();
+            AdvData[3] = 0; // single sample layout
+            send_packet();
+        }
+#elif defined IMU_LOW_LATENCY
+        /* read first, so the sample goes out in this period instead of the next one */
+        JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
+        result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+        JV_TRACE_END(JV_TRACE_IMU_READ);
+        uint32_t t_read = jv_timeUS();
+        uint32_t t_tx = t_read + tx_budget_us;
+
+        /* TX starts exactly tx_budget_us after the read, so the delta is known before encoding */
+        uint16_t delta = sample_to_tx_us(t_read, t_tx);
+        AdvData[22] = (uint8_t)delta;
+        AdvData[23] = (uint8_t)(delta >> 8);
+        next_sequence();
+        encode_packet_data();
+
+        uint32_t cost = jv_timeUS() - t_read;
+        if (cost < tx_budget_us)
+        {
+            jv_delayUntilUS(t_tx);
+        }
+        else if (delta != IMU_DELTA_UNKNOWN)
+        {
+            /* overrun, the first packet always is: TX is late, so its delta is not known */
+            AdvData[22] = (uint8_t)IMU_DELTA_UNKNOWN;
+            AdvData[23] = (uint8_t)(IMU_DELTA_UNKNOWN >> 8);
+            encode_packet_data();
+        }
+
+        /* track the encode cost: jump up to cover it, creep down otherwise */
+        if (cost + IMU_TX_MARGIN_US > tx_budget_us)
+            tx_budget_us = cost + IMU_TX_MARGIN_US;
+        else
+            tx_budget_us--;
+        JV_TRACE_END(JV_TRACE_WAKE_TO_TX);
+        transmit_packet();
+#elif defined IMU_FIFO
+        JV_TRACE_END(JV_TRACE_WAKE_TO_TX);
+
+        /* drain the IMU FIFO */
+        JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
+        result |= imu_fifo_read(&dev_ctx, fifo_samples, IMU_FIFO_MAX_SAMPLES, &fifo_count);
+        JV_TRACE_END(JV_TRACE_IMU_READ);
+
+#ifdef IMU_CODEC
+        /* the sample index as timestamp */
+        for (uint16_t i = 0; i < fifo_count; i++)
+        {
+            codec_samples[i].timestamp = (uint16_t)(fifo_index + i);
+            memcpy(codec_samples[i].gyro, &fifo_samples[i * IMU_FIFO_SAMPLE_SIZE], 6);
+            memcpy(codec_samples[i].accel, &fifo_samples[i * IMU_FIFO_SAMPLE_SIZE + 6], 6);
+        }
+
+        /* compress the batch into as few packets as it fits */
+        for (uint16_t i = 0; i < fifo_count;)
+        {
+            uint8_t n;
+            jv_imu_codec_encode(&AdvData[3], sizeof(AdvData) - 3, &codec_samples[i], fifo_count - i, &n);
+            i += n;
+
+            next_sequence();
+            send_packet();
+        }
+        fifo_index += fifo_count;
+#else
+        /* send the batch back to back */
+        send_fifo_samples();
+#endif
+#else
 #if defined USE_IMU && defined IMU_POWER_OFF
         /* power on IMU */
         result |= imu_power_on(&dev_ctx);
@@ -124,8 +459,25 @@ int main(void)
         data_ready = 0;
 #endif
         /* start transmission */
+        JV_TRACE_BEGIN(JV_TRACE_DMA_START);
+#if defined BSC_ASYNC_TX
+        SPI_DMA_Submit((uint32_t)packet_upscaled, upscaled_length, NULL);
+        /* encode the next packet into the other buffer while this one is on air */
+        packet_upscaled = (packet_upscaled == packet_upscaled_pool[0]) ? packet_upscaled_pool[1] : packet_upscaled_pool[0];
+#elif defined BSC_DMA_KEEP_ARMED
+        SPI_DMA_Retrigger(upscaled_length);
+#else
         SPI_DMA_Reinit((uint32_t)packet_upscaled, upscaled_length);
         SPI_DMA_Activate();
+#endif
+        JV_TRACE_END(JV_TRACE_DMA_START);
+        JV_TRACE_END(JV_TRACE_WAKE_TO_TX);
+
+#if defined USE_IMU && defined IMU_DMA_READ
+        /* read the IMU on SPI2 while SPI1 backscatters */
+        JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
+        imu_get_packet_data_start((uint16_t *)(&AdvData[4]));
+#endif
 
         /* update sequence number */
         AdvData[1] = (uint8_t)count;
@@ -152,47 +504,113 @@ int main(void)
         imu_interrupt_disable();
 
         /* get IMU data */
+        JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
         result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+        JV_TRACE_END(JV_TRACE_IMU_READ);
 
         /* power off IMU */
         result |= imu_power_off(&dev_ctx);
+#elif defined IMU_DRDY
+        /* newest sample, latched from the DRDY interrupt */
+        JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
+        imu_get_latest_packet_data((uint16_t *)(&AdvData[4]));
+        JV_TRACE_END(JV_TRACE_IMU_READ);
+#elif defined IMU_DMA_READ
+        /* wait for IMU data */
+        while (!imu_get_packet_data_done())
+        {
+            __WFE();
+        }
+        result |= imu_get_packet_data_result();
+        JV_TRACE_END(JV_TRACE_IMU_READ);
 #else
         /* get IMU data */
+        JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
         result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+        JV_TRACE_END(JV_TRACE_IMU_READ);
 #endif
 #endif
 
         /* update payload */
+        JV_TRACE_BEGIN(JV_TRACE_PDU_BUILD);
         create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA) / sizeof(AdvA[0]), AdvData, sizeof(AdvData) / sizeof(AdvData[0]));
+        JV_TRACE_END(JV_TRACE_PDU_BUILD);
 
+#ifdef BSC_ASYNC_TX
+        /* only the buffer on air may be pending, the other one is free to encode into */
+        while (SPI_DMA_Pending() > 1)
+        {
+            __WFE();
+        }
+#else
         /* wait for transmission to be complete */
         while (!DMA_SPI_TransmitCompleted())
         {
             __WFE();
         }
+#ifndef BSC_DMA_KEEP_ARMED
         SPI_DMA_Uninit();
+#endif
+#endif
 
         /* update packet */
+        JV_TRACE_BEGIN(JV_TRACE_CRC_WHITEN);
         update_advertising_packet(&packet, &pdu);
+        JV_TRACE_END(JV_TRACE_CRC_WHITEN);
 #ifdef BLE_CODED
+        JV_TRACE_BEGIN(JV_TRACE_FEC);
         coded_len = encode_packet(coded_buf, &packet);
+        JV_TRACE_END(JV_TRACE_FEC);
+        JV_TRACE_BEGIN(JV_TRACE_UPSCALE);
         upscaled_length = jv_bsc_upscale(packet_upscaled, coded_buf, coded_len);
+        JV_TRACE_END(JV_TRACE_UPSCALE);
 #else
+        JV_TRACE_BEGIN(JV_TRACE_UPSCALE);
         upscaled_length = jv_bsc_upscale(packet_upscaled, packet.whitened_packet, packet.packet_len);
+        JV_TRACE_END(JV_TRACE_UPSCALE);
 #endif
+#endif /* IMU_FIFO */
 
         /* wait for timer to be complete */
 #ifdef ENTER_DEEPSTOP
+#ifdef BSC_ASYNC_TX
+        /* DMA does not run in DEEPSTOP */
+        while (SPI_DMA_Pending())
+        {
+            __WFE();
+        }
+#endif
         ret_val = HAL_PWR_MNGR_Request(POWER_SAVE_LEVEL_STOP_WITH_TIMER, wakeupIO, &stopLevel);
         if (ret_val != SUCCESS)
             while (1)
                 ;
         SPI_DMA_Init((uint32_t)packet_upscaled, upscaled_length);
+#ifdef USE_IMU
+        HAL_SPI_DeInit(&hspiMaster); // SPI2 is not retained either, back to reset state so the init restores clock and pins
+        MX_SPI_MASTER_Init();
+#ifdef IMU_DMA_READ
+        imu_dma_init(); // DMAMUX requests, addresses and interrupts of channels 1/2
+#endif
+#endif
+        JV_TRACE_INIT(); // SysTick is not retained in DEEPSTOP
+        jv_timeUS_Resync();
+#else
+        JV_TRACE_BEGIN(JV_TRACE_RTC_WAIT);
+#ifdef IMU_ACTIVITY
+        while (!RTC_WakeupTimeout_Expired() && !data_ready)
 #else
         while (!RTC_WakeupTimeout_Expired())
+#endif
         {
             __WFE();
         }
+        JV_TRACE_END(JV_TRACE_RTC_WAIT);
+#endif
+#ifdef IMU_ACTIVITY
+        /* switch rate on an activity transition */
+        data_ready = 0;
+        result |= follow_activity(&dev_ctx);
 #endif
+        JV_TRACE_BEGIN(JV_TRACE_WAKE_TO_TX);
     }
 }
@@ -0,0 +1,95 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file dl_cmd.h
+ * @brief Endpoint configuration commands carried in the downlink payload
+ * @date 2023-03-27
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Downlink PDU: header (2), AdvA (6), sequence number (2), then commands
+ * until the end of the PDU:
+ *
+ *     byte 0   target link ID (high nibble, DL_CMD_BROADCAST for all) | opcode (low nibble)
+ *     byte 1.. argument, 1 Byte for opcodes 1 to 7, 3 Bytes for opcodes 8 to 15
+ *
+ *     DL_CMD_RATE     uplink on every Nth downlink, 1 to 255
+ *     DL_CMD_PHY      jv_packet_encoding_t: 0 1 Mbps, 1 2 Mbps, 2 coded S2, 3 coded S8
+ *     DL_CMD_CHANNEL  whitening channel, 0 to 39
+ *     DL_CMD_OFFSET   backscatter offset in 100 kHz, int8, see jv_bsc_set_offset_1Mbps()
+ *     DL_CMD_SLOT     uplink slot after the downlink
+ *     DL_CMD_IMU      DL_CMD_IMU_OFF or DL_CMD_IMU_ON
+ *     DL_CMD_FRAME    uplink slots per frame, 1 to 255, broadcast
+ *     DL_CMD_ASSIGN   short ID (2, little endian) and slot, broadcast: the endpoint
+ *                     with that short ID takes the slot as its link ID
+ *
+ * Only link IDs 0 to 14 can be targeted, endpoints in higher slots follow the
+ * broadcast commands. Opcode 0 is padding and ends the list, unknown opcodes
+ * are skipped. dl_cmd_Parse() runs in the radio callback and reads the
+ * commands in place from the RX buffer into the pending set, the main loop
+ * takes the set with dl_cmd_Take() after the uplink of the frame, so a frame
+ * never mixes two configurations. Values are range checked when they are
+ * applied.
+ *
+ */
+
+#ifndef INC_DL_CMD_H_
+#define INC_DL_CMD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DL_CMD_HEADER_LEN 10 // PDU header, AdvA and sequence number
+#define DL_CMD_BROADCAST  0x0F
+
+#define DL_CMD_RATE    1
+#define DL_CMD_PHY     2
+#define DL_CMD_CHANNEL 3
+#define DL_CMD_OFFSET  4
+#define DL_CMD_SLOT    5
+#define DL_CMD_IMU     6
+#define DL_CMD_FRAME   7
+#define DL_CMD_ASSIGN  8
+
+#define DL_CMD_IMU_OFF 0
+#define DL_CMD_IMU_ON  1
+
+typedef struct
+{
+    uint16_t mask; // bit (1 << opcode) for each command received since the last dl_cmd_Take()
+    uint8_t rate_div;
+    uint8_t phy;
+    uint8_t channel;
+    int8_t offset;
+    uint8_t slot;
+    uint8_t assign_slot; // DL_CMD_ASSIGN, kept apart from DL_CMD_SLOT
+    uint8_t imu;
+    uint8_t slot_count;
+} dl_cmd_t;
+
+/**
+ * @brief Collect the commands addressed to link_id from a received downlink
+ *
+ * Call from the radio callback once the address matched. A later command of
+ * the same opcode overrides an earlier one.
+ *
+ * @param pdu Received PDU, starting at the header
+ * @param pdu_len Header plus payload length
+ * @param link_id This endpoint's link ID
+ * @param short_id This endpoint's short ID, for DL_CMD_ASSIGN
+ */
+void dl_cmd_Parse(const uint8_t *pdu, uint16_t pdu_len, uint8_t link_id, uint16_t short_id);
+
+/**
+ * @brief Take the pending commands, call at a frame boundary while RX is off
+ *
+ * @param cmd Pending commands, mask tells which fields are valid
+ * @return true if at least one command is pending
+ */
+bool dl_cmd_Take(dl_cmd_t *cmd);
+
+#endif /* INC_DL_CMD_H_ */
@@ -0,0 +1,62 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file dl_sync.h
+ * @brief Downlink frame timing tracker, sizes the next RX wake and listen window
+ * @date 2023-03-22
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Every received downlink is compared with the arrival predicted from the
+ * previous one. The error corrects a frame period estimate (RTC drift against
+ * the reader) and feeds a mean absolute error (jitter). The RX window is then
+ * DL_SYNC_MIN_MARGIN_US plus DL_SYNC_JITTER_MULT times the jitter on each side
+ * of the prediction, widened by DL_SYNC_MISS_WIDEN_US per missed frame.
+ * Until DL_SYNC_MIN_SAMPLES downlinks were tracked the full RX_ASSOC_TOUT is used.
+ *
+ */
+
+#ifndef INC_DL_SYNC_H_
+#define INC_DL_SYNC_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Restart tracking from the nominal frame period
+ *
+ * @param period_us nominal downlink period
+ */
+void dl_sync_Reset(uint32_t period_us);
+
+/**
+ * @brief Record a received downlink
+ *
+ * @param rx_ticks RX timestamp on the RTC_GetTicks() timebase
+ */
+void dl_sync_Received(uint32_t rx_ticks);
+
+/**
+ * @brief Record a frame without a valid downlink, the prediction moves one period on
+ *
+ */
+void dl_sync_Missed(void);
+
+/**
+ * @brief When to call HAL_RADIO_ReceivePacket() with RX_WAKEUP_TIME for the next frame
+ *
+ * @return uint32_t absolute RTC ticks, for RTC_SetAlarm()
+ */
+uint32_t dl_sync_WakeTime(void);
+
+/**
+ * @brief RX timeout to pass to HAL_RADIO_ReceivePacket() for the next frame
+ *
+ * @return uint32_t listen window in us
+ */
+uint32_t dl_sync_RxTimeoutUS(void);
+
+#endif /* INC_DL_SYNC_H_ */
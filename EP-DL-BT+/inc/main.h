@@ -31,22 +31,90 @@
  *     Jeeva usually whitens packets for channel 0
  *     Beacons must be whitened for an advertising channel (37, 38, 39)
  *
+ * Downlink Commands:
+ *     The downlink payload can change the uplink rate divider, PHY, whitening channel,
+ *     backscatter offset, slot and IMU on/off at runtime, see dl_cmd.h. BLE_PHY,
+ *     BLE_CHANNEL, BLE_OFFSET and EP_LINK_ID are the values until the first command.
+ *
+ * Uplink Slots:
+ *     After each downlink the uplinks follow in slots of the uplink on-air time at the
+ *     current PHY plus UL_GUARD_US (100 us with BSC_TIMED_TX, else 580 us, the software start
+ *     follows the IMU read and encode), DL_CMD_FRAME sets the number of slots (UL_SLOTS_DEFAULT
+ *     until then). With EP_LINK_ID set to EP_LINK_ID_NONE the endpoint picks a random slot
+ *     each frame and sends a 16 bit short ID, derived from the device unique ID, in
+ *     AdvData[22..23], until DL_CMD_ASSIGN gives that short ID a slot. The same firmware
+ *     then runs on every endpoint. A slot assigned this way is released on disassociation.
+ *     A fixed EP_LINK_ID (0 to 254, the default is 0) is kept as the slot until a command
+ *     changes it, so gateways without DL_CMD_ASSIGN keep working.
+ *     An uplink whose slot would end after the RX alarm of the next frame is skipped, so
+ *     too many or too long slots for the downlink period cost uplinks, not downlinks.
+ *
+ * Disassociated Scan:
+ *     Without a gateway the endpoint listens for SCAN_LISTEN_US, one downlink period plus
+ *     a margin, then sleeps SCAN_SLEEP_MIN_US. Each empty window doubles the sleep up to
+ *     SCAN_SLEEP_MAX_US, so a gateway coming into range is found within SCAN_SLEEP_MAX_US
+ *     plus one window. Losing the link restarts from the shortest sleep.
+ *
  * Power Saving Options:
  *     IMU_POWER_OFF: turns off the IMU between packets
  *         Saves power, but takes time. Not possible for high packet rates.
- *     ENTER_DEEPSTOP: CPU enters DEEPSTOP mode between packets (otherwise, enters CPU HALT)
- *         Saves power, but can be a bit buggy/inconsistent
+ *     ENTER_DEEPSTOP: CPU enters DEEPSTOP mode between frames and between scan windows
+ *         (otherwise, enters CPU HALT). The RTC alarm wakes it early by the measured wake-up
+ *         and restore time plus DEEPSTOP_WAKE_MARGIN_US, starting from DEEPSTOP_RESTORE_US,
+ *         so RX still starts at the dl_sync wake time. The lead follows a longer wake-up at
+ *         once and creeps back down by 1 us per DEEPSTOP. The last and worst wake-up to RX times
+ *         are kept in dl_wake_to_rx_us and dl_wake_to_rx_max_us. Gaps below DEEPSTOP_MIN_SLEEP_US are
+ *         slept in CPU HALT. Not with IMU_DRDY, the IMU DMA stops in DEEPSTOP.
+ *
+ * IMU Read:
+ *     IMU_DRDY: the IMU data ready pulse starts a DMA read of each new sample into a double
+ *         buffer, and the uplink copies the newest one, so the slot never waits on the sensor.
+ *     IMU_POLICY: let jv_imu_policy pick power cycling or a matched ODR for the uplink rate
+ *         (downlink rate / DL_CMD_RATE divider) with the sample no older than
+ *         IMU_MAX_LATENCY_US, and re-plan on every DL_CMD_RATE change. A power cycled read
+ *         waits for the first sample, so the uplink is built before the RTC sleep
+ *         (UL_PREENCODE).
+ *     If imu_init() fails the IMU stays off, DL_CMD_IMU is ignored and AdvData[3] reads
+ *     EP_IMU_FAULT in every uplink.
+ *
+ * Uplink Encoding:
+ *     UL_PREENCODE: build, FEC encode and upscale the next uplink before the RTC sleep
+ *         instead of after the downlink, so the uplink starts DL_UL_DELAY after the downlink
+ *         without the encoding time in between. The payload (IMU sample, link ID) is then up to one frame older.
+ *         A downlink command that changes the encoding drops the prepared packet. That uplink,
+ *         like the first one after association, is encoded after the downlink and starts late
+ *         by the encoding time (with BSC_TIMED_TX it is skipped if its slot was missed).
+ *
+ * Backscatter DMA:
+ *     BSC_DMA_KEEP_ARMED: keep SPI1/DMA clocked and configured between packets and only
+ *         reload the transfer count (SPI_DMA_Retrigger). Cuts slot-to-first-bit latency,
+ *         compare with JV_TRACE_DMA_START. Costs the idle SPI1/DMA clock current.
+ *     BSC_TIMED_TX: start the uplink from a TIM17 compare at DL_UL_DELAY + slot * slot
+ *         length after the RX callback, counted from the downlink RX timestamp with the
+ *         timestamp to callback latency measured on each downlink, instead of a software
+ *         DMA start after a delay. Removes the start jitter, so UL_GUARD_US can be reduced. A missed slot is
+ *         skipped. Slots beyond TIMED_TX_MAX_US are reached with a jv_delayUntilUS() first.
+ *
+ * Debug Options:
+ *     JV_TRACE: record per-stage cycle counts (PDU build, CRC/whiten, FEC, upscale,
+ *         DMA, IMU read, RTC wait, DEEPSTOP wake to RX) into a .noinit trace buffer, see jv_trace.h
  *
  */
 
 /**********************/
 /* User configuration */
 /**********************/
-#define EP_LINK_ID		   0
+#define EP_LINK_ID		   0				// 0 to 254, or EP_LINK_ID_NONE for a slot assigned over the downlink
 //#define LED_BLINK          true
 //#define USE_IMU            true
 //#define IMU_POWER_OFF      true
+//#define IMU_DRDY           true
+//#define IMU_POLICY         true
 //#define ENTER_DEEPSTOP     true
+//#define BSC_DMA_KEEP_ARMED true
+//#define BSC_TIMED_TX       true
+//#define UL_PREENCODE       true
+//#define JV_TRACE           true
 
 /* BLE defines */
 #define BLE_CHANNEL			0
@@ -67,20 +135,62 @@
 #define RX_WAKEUP_TIME          300     		/* The minimum is 230us */
 
 /* Timings */
-#define DL_UL_DELAY				400
-#define UL_PKT_DURATION			900
-#define RX_DISASSOC_TOUT		0xFFFFFF 		/* 16.7s */
-#define RX_ASSOC_TOUT			1800			/* 2ms */
+#define DL_UL_DELAY				400				/* reader RX turnaround */
+#ifdef BSC_TIMED_TX
+#define UL_GUARD_US				100				/* between uplink slots, the start is hardware timed */
+#else
+#define UL_GUARD_US				580				/* between uplink slots, the old 900 us slot less the 1 Mbps airtime,
+												   covers the start jitter of the IMU read and encode */
+#endif
+#define UL_SLOTS_DEFAULT		3				/* uplink slots after each DL, until DL_CMD_FRAME */
+#define TIMED_TX_MAX_US			15000			/* TIM17 range, less a margin */
+#define RX_ASSOC_TOUT			1800			/* 2ms, RX window until the DL timing is tracked */
 #define ASSOC_DISASSOC_THRESH	10
-#define POLLINIG_RATE			25000
+#define POLLINIG_RATE			25000			/* nominal DL period, refined by dl_sync */
+#define DEEPSTOP_RESTORE_US		300				/* first guess of wake-up and restore, then measured */
+#define DEEPSTOP_WAKE_MARGIN_US	100
+#define DEEPSTOP_MIN_SLEEP_US	2000
+#define IMU_MAX_LATENCY_US		POLLINIG_RATE	/* IMU_POLICY, sample age at the uplink */
+
+/* Disassociated scan, listen:sleep from 1:2 backing off to 1:32 at the default period */
+#define SCAN_LISTEN_US			(POLLINIG_RATE + RX_ASSOC_TOUT)	/* a whole DL period, any DL in range is heard */
+#define SCAN_LISTEN_MIN_US		RX_ASSOC_TOUT	/* shortest rest of a window worth listening on after a foreign packet */
+#define SCAN_SLEEP_MIN_US		(2 * POLLINIG_RATE)
+#define SCAN_SLEEP_MAX_US		(32 * POLLINIG_RATE)	/* 0.8s, bounds the reacquisition time */
+
+/* DL timing tracking, see dl_sync.h */
+#define DL_SYNC_MIN_SAMPLES		4
+#define DL_SYNC_MIN_MARGIN_US	150				/* RTC tick rounding, wake latency */
+#define DL_SYNC_JITTER_MULT		4
+#define DL_SYNC_MISS_WIDEN_US	100
+#define DL_SYNC_PERIOD_GAIN		8				/* period filter, 1/8 of each error */
+#define DL_SYNC_JITTER_GAIN		8
+
+
+#define EP_LINK_ID_NONE			0xFF			/* slot assigned over the downlink */
+#define EP_IMU_FAULT			0xFF			/* AdvData[3] when imu_init() failed, no IMU data follows */
+
+/* 64 bit device unique ID */
+#define EP_UID_WORD0			(*(const uint32_t *)0x10001EF0)
+#define EP_UID_WORD1			(*(const uint32_t *)0x10001EF4)
+
+#if EP_LINK_ID > EP_LINK_ID_NONE
+#error "Unsupported LinkId"
+#endif
 
-/* RTC tick is ~61.035 us */
-#define RTC_DL_TO_RX_TIME		393
-#define RTC_TOUT_TO_RX_TIME		373
+#if defined IMU_DRDY && defined IMU_POWER_OFF
+#error "IMU_DRDY does not support IMU_POWER_OFF"
+#endif
 
+#if defined IMU_DRDY && defined ENTER_DEEPSTOP
+#error "IMU_DRDY does not support ENTER_DEEPSTOP"
+#endif
 
-#if EP_LINK_ID > 2
-#error "Unsupported LinkId"
+#ifdef IMU_POLICY
+#if !defined USE_IMU || !defined UL_PREENCODE || defined IMU_POWER_OFF || defined IMU_DRDY
+#error "IMU_POLICY needs USE_IMU and UL_PREENCODE, and does not support IMU_POWER_OFF or IMU_DRDY"
+#endif
+#define JV_IMU_POLICY_FIFO		0				/* one sample per uplink */
 #endif
 
 #ifdef IMU_POWER_OFF
@@ -113,12 +223,6 @@
 #error "Invalid BLE_PHY" XSTR(BLE_PHY)
 #endif
 
-#if BLE_PHY < 2000
-#define jv_bsc_upscale(x, y, z) jv_bsc_upscale_1Mbps(x, y, z)
-#else
-#define jv_bsc_upscale(x, y, z) jv_bsc_upscale_2Mbps(x, y, z)
-#endif
-
 /* Board pin defines */
 #define LED_GPIO
 #define LED_GPIO_PORT GPIOB
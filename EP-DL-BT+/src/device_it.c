@@ -12,8 +12,6 @@
 #include "rf_driver_hal_vtimer.h"
 
 
-extern TIM_HandleTypeDef htimx;
-
 /****************************************************************************/
 /*           Cortex Processor Interruption and Exception Handlers           */ 
 /****************************************************************************/
@@ -44,14 +42,6 @@ void SysTick_IRQHandler(void)
    HAL_SYSTICK_IRQHandler();
 }
 
-/**
-* @brief This function handles TIM1 global interrupt.
-*/
-void TIM1_IRQHandler(void)
-{
-	HAL_TIM_IRQHandler(&htimx);
-}
-
 void BLE_WKUP_IRQHandler(void)
 {
     HAL_VTIMER_WakeUpCallback();
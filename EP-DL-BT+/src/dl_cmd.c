@@ -0,0 +1,80 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file dl_cmd.c
+ * @brief Endpoint configuration commands carried in the downlink payload
+ * @date 2023-03-27
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ */
+
+#include "dl_cmd.h"
+
+/* written by the radio callback, read by the main loop only while RX is off */
+static dl_cmd_t pending;
+
+void dl_cmd_Parse(const uint8_t *pdu, uint16_t pdu_len, uint8_t link_id, uint16_t short_id)
+{
+    const uint8_t *cmd = pdu + DL_CMD_HEADER_LEN;
+    const uint8_t *end = pdu + pdu_len;
+    uint8_t len;
+
+    for (; cmd + 2 <= end; cmd += len)
+    {
+        uint8_t target = cmd[0] >> 4;
+        uint8_t opcode = cmd[0] & 0x0F;
+
+        len = (opcode < 8) ? 2 : 4;
+        if (opcode == 0 || cmd + len > end)
+            break; // padding or truncated
+        if (target != link_id && target != DL_CMD_BROADCAST)
+            continue;
+
+        switch (opcode)
+        {
+        case DL_CMD_RATE:
+            pending.rate_div = cmd[1];
+            break;
+        case DL_CMD_PHY:
+            pending.phy = cmd[1];
+            break;
+        case DL_CMD_CHANNEL:
+            pending.channel = cmd[1];
+            break;
+        case DL_CMD_OFFSET:
+            pending.offset = (int8_t)cmd[1];
+            break;
+        case DL_CMD_SLOT:
+            pending.slot = cmd[1];
+            break;
+        case DL_CMD_IMU:
+            pending.imu = cmd[1];
+            break;
+        case DL_CMD_FRAME:
+            pending.slot_count = cmd[1];
+            break;
+        case DL_CMD_ASSIGN:
+            if ((uint16_t)(cmd[1] | (cmd[2] << 8)) != short_id)
+                continue; // for another endpoint
+            pending.assign_slot = cmd[3];
+            break;
+        default:
+            continue; // unknown opcode, skip it
+        }
+        pending.mask |= 1U << opcode;
+    }
+}
+
+bool dl_cmd_Take(dl_cmd_t *cmd)
+{
+    if (pending.mask == 0)
+        return false;
+    *cmd = pending;
+    pending.mask = 0;
+    return true;
+}
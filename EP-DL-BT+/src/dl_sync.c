@@ -0,0 +1,94 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file dl_sync.c
+ * @brief Downlink frame timing tracker, sizes the next RX wake and listen window
+ * @date 2023-03-22
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ */
+
+#include "main.h"
+#include "dl_sync.h"
+#include "../lib/jv_BlueNRG-LP_lib/jv_rtc.h"
+
+/* All times in 1/65536 RTC ticks unless noted */
+static uint32_t period_q16;    // frame period estimate
+static uint32_t next_rx;       // predicted arrival of the next downlink, whole ticks
+static uint16_t next_frac;     //  and its fraction
+static uint32_t jitter_q16;    // mean absolute prediction error
+static uint8_t frames_missed;  // since the last received downlink
+static uint8_t samples;        // downlinks tracked, saturates at DL_SYNC_MIN_SAMPLES
+
+static void dl_sync_Advance(void)
+{
+    uint32_t frac = (uint32_t)next_frac + (period_q16 & 0xFFFF);
+
+    next_rx += (period_q16 >> 16) + (frac >> 16);
+    next_frac = (uint16_t)frac;
+}
+
+static uint32_t dl_sync_HalfWindowUS(void)
+{
+    uint32_t half_us = RX_ASSOC_TOUT / 2;
+
+    if (samples >= DL_SYNC_MIN_SAMPLES)
+    {
+        uint32_t tracked_us = DL_SYNC_MIN_MARGIN_US + DL_SYNC_JITTER_MULT * RTC_TICKS_TO_US(jitter_q16) / 65536;
+        if (tracked_us < half_us)
+            half_us = tracked_us;
+    }
+    return half_us + frames_missed * DL_SYNC_MISS_WIDEN_US;
+}
+
+void dl_sync_Reset(uint32_t period_us)
+{
+    period_q16 = (uint32_t)(((uint64_t)period_us * RTC_TICKS_PER_SEC << 16) / 1000000);
+    jitter_q16 = 0;
+    frames_missed = 0;
+    samples = 0;
+}
+
+void dl_sync_Received(uint32_t rx_ticks)
+{
+    if (samples)
+    {
+        /* error against the prediction, spread over the frames since the last downlink */
+        int32_t err_q16 = (int32_t)((rx_ticks - next_rx) << 16) - next_frac;
+        uint32_t abs_q16 = err_q16 < 0 ? -err_q16 : err_q16;
+
+        period_q16 += err_q16 / ((int32_t)(frames_missed + 1) * DL_SYNC_PERIOD_GAIN);
+        jitter_q16 += ((int32_t)(abs_q16 - jitter_q16)) / DL_SYNC_JITTER_GAIN;
+    }
+    if (samples < DL_SYNC_MIN_SAMPLES)
+        samples++;
+    frames_missed = 0;
+
+    next_rx = rx_ticks;
+    next_frac = 0;
+    dl_sync_Advance();
+}
+
+void dl_sync_Missed(void)
+{
+    if (frames_missed < UINT8_MAX)
+        frames_missed++;
+    dl_sync_Advance();
+}
+
+uint32_t dl_sync_WakeTime(void)
+{
+    /* RX opens RX_WAKEUP_TIME after the call, half a window before the prediction */
+    return next_rx - RTC_US_TO_TICKS(RX_WAKEUP_TIME + dl_sync_HalfWindowUS()) - 1;
+}
+
+uint32_t dl_sync_RxTimeoutUS(void)
+{
+    /* the extra tick covers rounding the wake time down to a whole RTC tick */
+    return 2 * dl_sync_HalfWindowUS() + RTC_TICKS_TO_US(1) + 1;
+}
@@ -14,24 +14,33 @@
  *
  */
 #include <stdint.h>
+#include <string.h>
 #include "rf_driver_hal.h"
 #include "rf_driver_hal_vtimer.h"
 #include "rf_driver_hal_radio_2g4.h"
 #include "main.h"
+#include "dl_sync.h"
+#include "dl_cmd.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_spi_bsc.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_rtc.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_gpio.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_delayUS.h"
+#include "../lib/jv_BlueNRG-LP_lib/jv_trace.h"
 #include "../lib/jv_LSM6DSO32_lib/jv_imu.h"
+#include "../lib/jv_LSM6DSO32_lib/jv_imu_policy.h"
 #include "../lib/jv_bt+packet_lib/jv_bt+packet.h"
 #include "../lib/jv_bt+packet_lib/jv_bt+bsc.h"
 
 
 /* IMU SPI communication */
 SPI_HandleTypeDef hspiMaster;
-__attribute((aligned(4))) uint8_t aTxBuffer[32];                // Buffer used for transmission;
-uint8_t ubNbDataToTransmit = sizeof(aTxBuffer);                 // Data length to transmit
-__attribute((aligned(4))) uint8_t aRxBuffer[sizeof(aTxBuffer)]; // Buffer used for reception
+#ifdef USE_IMU
+stmdev_ctx_t dev_ctx;
+int32_t result = 0;
+#endif
+#ifdef IMU_POLICY
+jv_imu_plan_t imu_plan;
+#endif
 
 /* BLE packet buffers */
 #ifdef USE_IMU
@@ -56,12 +65,39 @@ uint32_t upscaled_length;
 /* Buffer used for storing received data */
 __attribute((aligned(4))) uint8_t rxBuff[MAX_LL_PACKET_LENGTH] = {0};
 
-const uint8_t linkID = EP_LINK_ID;
+uint8_t linkID = EP_LINK_ID;				// with EP_LINK_ID_NONE, until a slot is assigned
+uint16_t ep_short_id;						// from the device unique ID, for DL_CMD_ASSIGN
 volatile uint8_t data_ready = 0;
 // volatile uint16_t dl_seq_num = 0;
 volatile bool radio_dl_received = false;
 volatile bool radio_dl_timeout = false;
 volatile bool radio_dl_err = false;
+volatile uint32_t dl_rx_timestamp = 0;	// sys time units (625/256 us)
+volatile uint32_t dl_rx_cb_us = 0;		// RX timestamp until the callback of the same downlink
+volatile uint32_t dl_event_rtc = 0;		// RTC ticks of the last RX outcome
+#ifdef ENTER_DEEPSTOP
+uint32_t dl_rx_wake;						// RTC ticks to start the next RX at, dl_sync_WakeTime()
+uint32_t deepstop_lead_ticks;				// wake this much before dl_rx_wake, from dl_wake_lead_us
+uint32_t dl_wake_lead_us;					// tracked wake-up, jumps up to the last one, creeps down otherwise
+uint32_t dl_wake_to_rx_us;					// last DEEPSTOP wake-up until ready for RX
+uint32_t dl_wake_to_rx_max_us;
+#endif
+
+/* uplink configuration, changed by downlink commands at frame boundaries */
+uint8_t ul_slot = EP_LINK_ID;
+uint8_t ul_slot_count = UL_SLOTS_DEFAULT;
+uint32_t ul_slot_us;					// on-air time of the uplink plus UL_GUARD_US
+uint32_t rx_alarm_rtc;					// RTC alarm of the next RX, the uplink has to end before it
+uint8_t ul_rate_div = 1;				// uplink on every Nth downlink
+uint8_t ul_frame = 0;					// downlinks since the last uplink
+uint8_t ul_channel = BLE_CHANNEL;
+jv_packet_encoding_t ul_encoding = BLE_PACKET_TYPE;
+bool ul_imu_on = true;
+bool ul_ready = false;					// packet_upscaled already holds the next uplink
+
+/* disassociated scan */
+uint32_t scan_sleep_us = SCAN_SLEEP_MIN_US;	// between listen windows, backs off up to SCAN_SLEEP_MAX_US
+uint32_t scan_listen_end;					// RTC ticks
 
 enum EP_state
 {
@@ -74,15 +110,22 @@ uint8_t RxCallback(ActionPacket* p, ActionPacket* next)
 {
 	if ((p->status & BLUE_INTERRUPT1REG_DONE) != 0)
 	{
+		dl_event_rtc = RTC_GetTicks();
 		if ((p->status & BLUE_STATUSREG_PREVTRANSMIT) == 0)
 		{
 			if ((p->status & BLUE_INTERRUPT1REG_RCVOK) != 0)
 			{
 				/* Make sure the packet format matches, and we are get the right Advertising Address */
-				if (rxBuff[0] == 0x02 && rxBuff[1] == 0x08 && rxBuff[2] == BLE_ADV_ADDR_5 && rxBuff[3] == BLE_ADV_ADDR_4 && \
+				if (rxBuff[0] == 0x02 && rxBuff[1] >= 0x08 && rxBuff[2] == BLE_ADV_ADDR_5 && rxBuff[3] == BLE_ADV_ADDR_4 && \
 						rxBuff[4] == BLE_ADV_ADDR_3 && rxBuff[5] == BLE_ADV_ADDR_2 && rxBuff[6] == BLE_ADV_ADDR_1 && rxBuff[7] == BLE_ADV_ADDR_0)
 				{
 					// dl_seq_num = (uint16_t)rxBuff[9] << 8 | rxBuff[8];
+					dl_rx_timestamp = p->timestamp_receive;
+					dl_rx_cb_us = ((HAL_VTIMER_GetCurrentSysTime() - dl_rx_timestamp) * 625) >> 8;
+					/* move the event back to the RX timestamp on the RTC timebase */
+					dl_event_rtc -= RTC_US_TO_TICKS(dl_rx_cb_us);
+					/* commands after the sequence number, read in place */
+					dl_cmd_Parse(rxBuff, (rxBuff[1] + 2 < MAX_LL_PACKET_LENGTH) ? rxBuff[1] + 2 : MAX_LL_PACKET_LENGTH, linkID, ep_short_id);
 					radio_dl_received = true;
 				}
 				else
@@ -106,13 +149,333 @@ uint8_t RxCallback(ActionPacket* p, ActionPacket* next)
 	return TRUE;
 }
 
-void ep_send_ble_packet(void)
+/**
+ * @brief Encode the whitened packet for the current PHY into packet_upscaled
+ *
+ */
+static void ep_upscale_packet(void)
 {
-	static uint16_t count = 0;
+	if (packet.encoding == CODED_S2 || packet.encoding == CODED_S8)
+	{
+		JV_TRACE_BEGIN(JV_TRACE_FEC);
+		coded_len = encode_packet(coded_buf, &packet);
+		JV_TRACE_END(JV_TRACE_FEC);
+		JV_TRACE_BEGIN(JV_TRACE_UPSCALE);
+		upscaled_length = jv_bsc_upscale_1Mbps(packet_upscaled, coded_buf, coded_len);
+		JV_TRACE_END(JV_TRACE_UPSCALE);
+	}
+	else
+	{
+		JV_TRACE_BEGIN(JV_TRACE_UPSCALE);
+		if (packet.encoding == UNCODED_2MBPS)
+			upscaled_length = jv_bsc_upscale_2Mbps(packet_upscaled, packet.whitened_packet, packet.packet_len);
+		else
+			upscaled_length = jv_bsc_upscale_1Mbps(packet_upscaled, packet.whitened_packet, packet.packet_len);
+		JV_TRACE_END(JV_TRACE_UPSCALE);
+	}
+}
 
-#ifdef LED_BLINK
-	led_toggle();
+/**
+ * @brief Re-initialize the uplink packet for the current channel and PHY, and size the slots for it
+ *
+ */
+static void ep_init_packet(void)
+{
+	init_packet(&packet, ul_channel, &pdu, ul_encoding);
+	ul_slot_us = packet_airtime_us(&packet) + UL_GUARD_US;
+}
+
+/**
+ * @brief Slot of this frame's uplink, a random one while no slot is assigned
+ *
+ */
+static uint8_t ep_ul_slot(void)
+{
+	static uint16_t lfsr = 0;
+
+	if (ul_slot != EP_LINK_ID_NONE)
+		return ul_slot;
+
+	/* contend until the gateway assigns a slot to the short ID it hears */
+	if (lfsr == 0)
+		lfsr = ep_short_id | 1;
+	lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB400);
+	return lfsr % ul_slot_count;
+}
+
+/**
+ * @brief Forget a slot assigned over the downlink, the next gateway assigns its own
+ *
+ */
+static void ep_release_slot(void)
+{
+	if (EP_LINK_ID == EP_LINK_ID_NONE)
+	{
+		linkID = EP_LINK_ID_NONE;
+		ul_slot = EP_LINK_ID_NONE;
+		ul_slot_count = UL_SLOTS_DEFAULT;
+	}
+}
+
+#ifdef IMU_POLICY
+/**
+ * @brief Let the IMU policy pick the cheapest mode for the uplink rate and apply it
+ *
+ * The uplink rate is the nominal downlink rate divided by ul_rate_div, rounded up.
+ * A rate no mode meets within IMU_MAX_LATENCY_US keeps the current mode.
+ *
+ */
+static void ep_imu_follow_rate(void)
+{
+	uint32_t ul_period_us = (uint32_t)POLLINIG_RATE * ul_rate_div;
+
+	if (jv_imu_policy_plan((1000000 + ul_period_us - 1) / ul_period_us, IMU_MAX_LATENCY_US, &imu_plan) == 0)
+		result |= jv_imu_policy_apply(&dev_ctx, &imu_plan);
+}
+#endif
+
+/**
+ * @brief Apply the downlink commands of this frame, after its uplink and before the next RX
+ *
+ */
+static void ep_apply_dl_cmd(void)
+{
+	dl_cmd_t cmd;
+	bool reinit = false;
+
+	if (!dl_cmd_Take(&cmd))
+		return;
+
+	if ((cmd.mask & (1U << DL_CMD_RATE)) && cmd.rate_div != 0 && cmd.rate_div != ul_rate_div)
+	{
+		ul_rate_div = cmd.rate_div;
+#ifdef IMU_POLICY
+		if (ul_imu_on)
+			ep_imu_follow_rate(); // a slower uplink may power cycle the IMU, a faster one needs a higher ODR
+#endif
+	}
+	if ((cmd.mask & (1U << DL_CMD_PHY)) && cmd.phy <= CODED_S8)
+	{
+		ul_encoding = (jv_packet_encoding_t)cmd.phy;
+		reinit = true;
+	}
+	if ((cmd.mask & (1U << DL_CMD_CHANNEL)) && cmd.channel <= 39)
+	{
+		ul_channel = cmd.channel;
+		reinit = true;
+	}
+	if (cmd.mask & (1U << DL_CMD_OFFSET))
+	{
+		jv_bsc_set_offset_1Mbps(cmd.offset); // unsupported offsets are ignored
+		ul_ready = false;
+	}
+	if ((cmd.mask & (1U << DL_CMD_FRAME)) && cmd.slot_count != 0)
+		ul_slot_count = cmd.slot_count;
+	if ((cmd.mask & (1U << DL_CMD_SLOT)) && cmd.slot < ul_slot_count)
+		ul_slot = cmd.slot;
+	if ((cmd.mask & (1U << DL_CMD_ASSIGN)) && cmd.assign_slot < ul_slot_count) // never EP_LINK_ID_NONE
+	{
+		linkID = cmd.assign_slot;
+		ul_slot = cmd.assign_slot;
+	}
+#ifdef USE_IMU
+	if ((cmd.mask & (1U << DL_CMD_IMU)) && (cmd.imu == DL_CMD_IMU_ON) != ul_imu_on && AdvData[3] != EP_IMU_FAULT)
+	{
+		ul_imu_on = !ul_imu_on;
+#ifndef IMU_POWER_OFF
+		/* with IMU_POWER_OFF the IMU is only on around each read anyway */
+#ifdef IMU_DRDY
+		imu_drdy_latch_pause(); // the latch DMA shares SPI2 with the blocking calls
+#endif
+#ifdef IMU_POLICY
+		if (ul_imu_on)
+			ep_imu_follow_rate(); // the plan for the current rate, instead of XL_ODR/GY_ODR
+		else
+			result |= imu_power_off(&dev_ctx);
+#else
+		result |= ul_imu_on ? imu_power_on(&dev_ctx) : imu_power_off(&dev_ctx);
+#endif
+#ifdef IMU_DRDY
+		if (ul_imu_on)
+			imu_drdy_latch_resume();
+#endif
 #endif
+		if (!ul_imu_on)
+			memset(&AdvData[4], 0, 18); // no stale samples
+		ul_ready = false;
+	}
+#endif
+	if (cmd.mask & (1U << DL_CMD_ASSIGN))
+		ul_ready = false; // new link ID
+
+	if (reinit)
+	{
+		ep_init_packet();
+		ul_ready = false;
+	}
+}
+
+/**
+ * @brief Arm the RTC alarm for the next RX
+ *
+ * @param wake RTC ticks to call HAL_RADIO_ReceivePacket() at
+ */
+static void ep_set_rx_alarm(uint32_t wake)
+{
+#ifdef ENTER_DEEPSTOP
+	/* wake early enough to restore the peripherals before RX is due */
+	dl_rx_wake = wake;
+	rx_alarm_rtc = dl_rx_wake - deepstop_lead_ticks;
+#else
+	rx_alarm_rtc = wake;
+#endif
+	RTC_SetAlarm(rx_alarm_rtc);
+}
+
+#ifdef ENTER_DEEPSTOP
+/**
+ * @brief Sleep in DEEPSTOP until the next downlink RX is due
+ *
+ * POWER_SAVE_LEVEL_STOP_WITH_TIMER keeps the VTIMER running, so the radio stays
+ * on its timebase, and the power manager only halts the CPU when a VTIMER event
+ * is due before the alarm. After a DEEPSTOP the peripherals DEEPSTOP does not
+ * retain are restored, and the time from the alarm until then is measured. The
+ * lead of the next alarm covers it plus DEEPSTOP_WAKE_MARGIN_US, jumping up to a
+ * longer wake-up and creeping down by 1 us per DEEPSTOP otherwise, so one slow
+ * wake-up does not cost the extra lead forever. The rest of the lead is slept
+ * in CPU HALT.
+ *
+ */
+static void ep_deepstop_until_rx(void)
+{
+	WakeupSourceConfig_TypeDef wakeupIO;
+	PowerSaveLevels stopLevel;
+	uint32_t alarm = dl_rx_wake - deepstop_lead_ticks;
+	uint32_t ready_ticks;
+	uint32_t restore_start_us;
+	bool slept = false;
+
+	wakeupIO.RTC_enable = 1;
+	wakeupIO.LPU_enable = 0;
+	wakeupIO.IO_Mask_Low_polarity = NO_WAKEUP_SOURCE;
+	wakeupIO.IO_Mask_High_polarity = NO_WAKEUP_SOURCE;
+
+	while (!RTC_Alarm_Expired())
+	{
+		/* a short gap is not worth the restore, and the alarm must not pass while going down */
+		if ((int32_t)(alarm - RTC_GetTicks()) > (int32_t)RTC_US_TO_TICKS(DEEPSTOP_MIN_SLEEP_US))
+		{
+			if (HAL_PWR_MNGR_Request(POWER_SAVE_LEVEL_STOP_WITH_TIMER, wakeupIO, &stopLevel) != SUCCESS)
+				while (1)
+					;
+			if (stopLevel >= POWER_SAVE_LEVEL_STOP_WITH_TIMER)
+				slept = true;
+		}
+		else
+		{
+			__WFE();
+		}
+	}
+	if (!slept)
+		return;
+
+	/* peripherals not retained in DEEPSTOP, TIM2 first so the restore can be timed */
+	jv_timeUS_Resync();
+	ready_ticks = RTC_GetTicks();
+	restore_start_us = jv_timeUS();
+	JV_TRACE_INIT(); // SysTick is not retained in DEEPSTOP
+	JV_TRACE_BEGIN(JV_TRACE_WAKE_TO_RX);
+	jv_delayUS_Init();
+	SPI_DMA_Init((uint32_t)packet_upscaled, upscaled_length);
+#ifdef BSC_TIMED_TX
+	SPI_DMA_TimedInit();
+#endif
+#ifdef USE_IMU
+	HAL_SPI_DeInit(&hspiMaster); // back to reset state, so the init restores clock and pins
+	MX_SPI_MASTER_Init();
+#endif
+
+	dl_wake_to_rx_us = RTC_TICKS_TO_US(ready_ticks - alarm) + (jv_timeUS() - restore_start_us);
+	if (dl_wake_to_rx_us > dl_wake_to_rx_max_us)
+		dl_wake_to_rx_max_us = dl_wake_to_rx_us;
+	/* track the wake-up: jump up to cover it, creep down otherwise */
+	if (dl_wake_to_rx_us > dl_wake_lead_us)
+		dl_wake_lead_us = dl_wake_to_rx_us;
+	else
+		dl_wake_lead_us--;
+	deepstop_lead_ticks = RTC_US_TO_TICKS(dl_wake_lead_us + DEEPSTOP_WAKE_MARGIN_US) + 1;
+
+	/* the rest of the lead */
+	ready_ticks = RTC_GetTicks();
+	if ((int32_t)(dl_rx_wake - ready_ticks) > 0)
+		jv_delayUntilUS(jv_timeUS() + RTC_TICKS_TO_US(dl_rx_wake - ready_ticks));
+}
+#endif
+
+/**
+ * @brief Sleep until the alarm set by ep_set_rx_alarm(), in DEEPSTOP or CPU HALT
+ *
+ */
+static void ep_wait_rx_alarm(void)
+{
+#ifdef ENTER_DEEPSTOP
+	ep_deepstop_until_rx();
+#else
+	JV_TRACE_BEGIN(JV_TRACE_RTC_WAIT);
+	while (!RTC_Alarm_Expired())
+	{
+		__WFE();
+	}
+	JV_TRACE_END(JV_TRACE_RTC_WAIT);
+#endif
+}
+
+/**
+ * @brief Listen for a downlink while disassociated
+ *
+ * @param listen_us RX window, ends with radio_dl_timeout if nothing is heard
+ */
+static void ep_scan_listen(uint32_t listen_us)
+{
+	scan_listen_end = RTC_GetTicks() + RTC_US_TO_TICKS(RX_WAKEUP_TIME + listen_us);
+	HAL_RADIO_ReceivePacket(BLE_DL_CHANNEL, RX_WAKEUP_TIME, rxBuff, listen_us, MAX_LL_PACKET_LENGTH, RxCallback);
+}
+
+/**
+ * @brief End of a scan window without a downlink: back off, then listen again
+ *
+ * A packet that is not ours keeps the radio listening for the rest of the window.
+ * An empty window sleeps scan_sleep_us, which doubles up to SCAN_SLEEP_MAX_US.
+ *
+ * @param heard_other true if the window ended on a CRC error or a foreign packet
+ */
+static void ep_scan_next(bool heard_other)
+{
+	int32_t left_ticks = (int32_t)(scan_listen_end - RTC_GetTicks());
+
+	if (heard_other && left_ticks > (int32_t)RTC_US_TO_TICKS(RX_WAKEUP_TIME + SCAN_LISTEN_MIN_US))
+	{
+		HAL_RADIO_ReceivePacket(BLE_DL_CHANNEL, RX_WAKEUP_TIME, rxBuff, RTC_TICKS_TO_US(left_ticks) - RX_WAKEUP_TIME,
+								MAX_LL_PACKET_LENGTH, RxCallback);
+		return;
+	}
+
+	ep_set_rx_alarm(RTC_GetTicks() + RTC_US_TO_TICKS(scan_sleep_us));
+	ep_wait_rx_alarm();
+	scan_sleep_us = (scan_sleep_us < SCAN_SLEEP_MAX_US / 2) ? 2 * scan_sleep_us : SCAN_SLEEP_MAX_US;
+	ep_scan_listen(SCAN_LISTEN_US);
+}
+
+/**
+ * @brief Build and encode the next uplink into packet_upscaled
+ *
+ * With UL_PREENCODE this runs before the RTC sleep, so after the downlink only
+ * the slot wait and the DMA start remain.
+ *
+ */
+static void ep_build_ble_packet(void)
+{
+	static uint16_t count = 0;
 
 	/* linkID */
 	AdvData[0] = linkID;
@@ -121,11 +484,16 @@ void ep_send_ble_packet(void)
 	// AdvData[2] = (uint8_t)(dl_seq_num >> 8);
 	AdvData[1] = (uint8_t)count;
 	AdvData[2] = (uint8_t)(count >> 8);
+	/* short ID, so the gateway can assign a slot */
+	AdvData[22] = (uint8_t)ep_short_id;
+	AdvData[23] = (uint8_t)(ep_short_id >> 8);
 
 	/* increment sequence number */
 	count++;
 
 #ifdef USE_IMU
+	if (ul_imu_on)
+	{
 #ifdef IMU_POWER_OFF
 	/* power on IMU */
 	result |= imu_power_on(&dev_ctx);
@@ -140,43 +508,123 @@ void ep_send_ble_packet(void)
 	imu_interrupt_disable();
 
 	/* get IMU data */
+	JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
 	result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+	JV_TRACE_END(JV_TRACE_IMU_READ);
 
 	/* power off IMU */
 	result |= imu_power_off(&dev_ctx);
+#elif defined IMU_DRDY
+	/* newest sample, latched from the DRDY interrupt */
+	JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
+	imu_get_latest_packet_data((uint16_t *)(&AdvData[4]));
+	JV_TRACE_END(JV_TRACE_IMU_READ);
+#elif defined IMU_POLICY
+	/* one sample, the way the policy chose for this uplink rate */
+	JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
+	result |= jv_imu_policy_read(&dev_ctx, &imu_plan, (uint16_t *)(&AdvData[4]));
+	JV_TRACE_END(JV_TRACE_IMU_READ);
 #else
 	/* get IMU data */
+	JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
 	result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+	JV_TRACE_END(JV_TRACE_IMU_READ);
 #endif
+	}
 #endif
 
 	/* update payload */
+	JV_TRACE_BEGIN(JV_TRACE_PDU_BUILD);
 	create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA) / sizeof(AdvA[0]), AdvData, sizeof(AdvData) / sizeof(AdvData[0]));
+	JV_TRACE_END(JV_TRACE_PDU_BUILD);
 
 	/* update packet */
+	JV_TRACE_BEGIN(JV_TRACE_CRC_WHITEN);
 	update_advertising_packet(&packet, &pdu);
-#ifdef BLE_CODED
-	coded_len = encode_packet(coded_buf, &packet);
-	upscaled_length = jv_bsc_upscale(packet_upscaled, coded_buf, coded_len);
-#else
-	upscaled_length = jv_bsc_upscale(packet_upscaled, packet.whitened_packet, packet.packet_len);
+	JV_TRACE_END(JV_TRACE_CRC_WHITEN);
+	ep_upscale_packet();
+	ul_ready = true;
+}
+
+void ep_send_ble_packet(void)
+{
+	uint8_t slot = ep_ul_slot();
+	int32_t alarm_ticks;
+	uint32_t alarm_us;
+
+#ifdef LED_BLINK
+	led_toggle();
 #endif
 
+	if (!ul_ready)
+		ep_build_ble_packet();
+	ul_ready = false;
+
+	/* a slot that ends after the next RX alarm is skipped, the downlink comes first */
+	alarm_ticks = (int32_t)(rx_alarm_rtc - RTC_GetTicks());
+	alarm_us = jv_timeUS() + (alarm_ticks > 0 ? RTC_TICKS_TO_US(alarm_ticks) : 0);
+
+#ifdef BSC_TIMED_TX
+	/* Same slot as below, but counted from the downlink RX timestamp and started by
+	 * TIM17 in hardware, so the encoding time and interrupt latency do not move it.
+	 * The offset is the measured timestamp to callback latency plus DL_UL_DELAY, so
+	 * the uplink never starts before DL_UL_DELAY after the callback.
+	 * */
+	uint32_t slot_us = dl_rx_cb_us + DL_UL_DELAY + slot * ul_slot_us;
+	uint32_t elapsed_us;
+
+	elapsed_us = ((HAL_VTIMER_GetCurrentSysTime() - dl_rx_timestamp) * 625) >> 8;
+	if ((int32_t)(alarm_us - (jv_timeUS() - elapsed_us + slot_us + ul_slot_us)) < 0)
+		return;
+
+	/* TIM17 only reaches TIMED_TX_MAX_US, sleep through the earlier slots first */
+	if (slot_us > elapsed_us + TIMED_TX_MAX_US)
+		jv_delayUntilUS(jv_timeUS() + (slot_us - elapsed_us - TIMED_TX_MAX_US));
+
+	jv_gpioReset(DBG_GPIO);
+	JV_TRACE_BEGIN(JV_TRACE_DMA_START);
+	__disable_irq();
+	elapsed_us = ((HAL_VTIMER_GetCurrentSysTime() - dl_rx_timestamp) * 625) >> 8;
+	if (elapsed_us >= slot_us)
+	{
+		/* slot already missed, do not collide with the next endpoint */
+		__enable_irq();
+		JV_TRACE_END(JV_TRACE_DMA_START);
+		jv_gpioSet(DBG_GPIO);
+		return;
+	}
+	SPI_DMA_Reinit((uint32_t)packet_upscaled, upscaled_length);
+	SPI_DMA_ActivateIn((slot_us - elapsed_us) * SPI_DMA_TIMED_TICKS_PER_US);
+	__enable_irq();
+#else
 	/* cc26xx needs some time to prepare for receiving after downlink has been transmitted.
 	 * Add also a timing slot for every endpoint depend of the linkID.
 	 * */
-	jv_delayUS(DL_UL_DELAY + (EP_LINK_ID * UL_PKT_DURATION));
+	uint32_t start_us = jv_timeUS() + DL_UL_DELAY + slot * ul_slot_us;
+
+	if ((int32_t)(alarm_us - (start_us + ul_slot_us)) < 0)
+		return;
+	jv_delayUntilUS(start_us);
 
 	jv_gpioReset(DBG_GPIO);
 	/* start transmission */
+	JV_TRACE_BEGIN(JV_TRACE_DMA_START);
+#ifdef BSC_DMA_KEEP_ARMED
+	SPI_DMA_Retrigger(upscaled_length);
+#else
 	SPI_DMA_Reinit((uint32_t)packet_upscaled, upscaled_length);
 	SPI_DMA_Activate();
+#endif
+#endif
+	JV_TRACE_END(JV_TRACE_DMA_START);
 	/* wait for transmission to be complete */
 	while (!DMA_SPI_TransmitCompleted())
 	{
 		__WFE();
 	}
+#ifndef BSC_DMA_KEEP_ARMED
 	SPI_DMA_Uninit();
+#endif
 
 	jv_gpioSet(DBG_GPIO);
 }
@@ -211,16 +659,12 @@ int main(void)
 	jv_delayUS_Init();
     /* RTC timer initialization */
     RTC_WakeupInit();
+    /* us timebase, needs the RTC */
+    jv_timeUS_Init();
 
 #ifdef ENTER_DEEPSTOP
-    uint8_t ret;
-    WakeupSourceConfig_TypeDef wakeupIO;
-    PowerSaveLevels stopLevel;
-    wakeupIO.RTC_enable = 1;
-    wakeupIO.LPU_enable = 0;
-    wakeupIO.IO_Mask_Low_polarity = NO_WAKEUP_SOURCE;
-    wakeupIO.IO_Mask_High_polarity = NO_WAKEUP_SOURCE;
-    uint32_t wakeupSource;
+    dl_wake_lead_us = DEEPSTOP_RESTORE_US;
+    deepstop_lead_ticks = RTC_US_TO_TICKS(dl_wake_lead_us + DEEPSTOP_WAKE_MARGIN_US) + 1;
 #endif
 
     /* Radio initialization */
@@ -233,33 +677,46 @@ int main(void)
 #ifdef USE_IMU
     HAL_Init();
     MX_SPI_MASTER_Init();
-    stmdev_ctx_t dev_ctx;
-    int32_t result = 0;
     dev_ctx.write_reg = platform_write;
     dev_ctx.read_reg = platform_read;
     dev_ctx.handle = &hspiMaster;
-    result |= imu_init(&dev_ctx);
-    result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+    if (imu_init(&dev_ctx) != 0)
+    {
+        /* uplinks go on without IMU data, flagged for the gateway */
+        ul_imu_on = false;
+        AdvData[3] = EP_IMU_FAULT;
+    }
+    else
+    {
+        result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+#ifdef IMU_POLICY
+        ep_imu_follow_rate();
+#endif
 #ifdef IMU_POWER_OFF
-    imu_interrupt_init();
-    imu_interrupt_enable();
+        imu_interrupt_init();
+        imu_interrupt_enable();
+#endif
+#ifdef IMU_DRDY
+        imu_drdy_latch_init();
 #endif
+    }
 #endif
 
+    /* stage tracing, after HAL_Init() which starts the SysTick tick */
+    JV_TRACE_INIT();
+
     /* BLE packet / BSC SPI init */
     AdvData[1] = 0x00;
     AdvData[2] = 0x00;
     create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA) / sizeof(AdvA[0]), AdvData, sizeof(AdvData) / sizeof(AdvData[0]));
-    init_packet(&packet, BLE_CHANNEL, &pdu, BLE_PACKET_TYPE);
-
-#ifdef BLE_CODED
-    coded_len = encode_packet(coded_buf, &packet);
-    upscaled_length = jv_bsc_upscale(packet_upscaled, coded_buf, coded_len);
-#else
-    upscaled_length = jv_bsc_upscale(packet_upscaled, packet.whitened_packet, packet.packet_len);
-#endif
+    ep_short_id = (uint16_t)(EP_UID_WORD0 ^ (EP_UID_WORD0 >> 16) ^ EP_UID_WORD1 ^ (EP_UID_WORD1 >> 16));
+    ep_init_packet();
+    ep_upscale_packet();
 
     SPI_DMA_Init((uint32_t)packet_upscaled, upscaled_length);
+#ifdef BSC_TIMED_TX
+    SPI_DMA_TimedInit();
+#endif
 
     /* infinite program loop */
     while (1)
@@ -273,41 +730,54 @@ int main(void)
     			if (state_changed)
     			{
     				state_changed = false;
-    				/* Put the radio in continuous RX mode until we get DL */
-    				HAL_RADIO_ReceivePacket(BLE_DL_CHANNEL, RX_WAKEUP_TIME, rxBuff, RX_DISASSOC_TOUT, MAX_LL_PACKET_LENGTH, RxCallback);
+    				/* listen at least one DL period, then sleep, backing off while nothing is heard */
+    				scan_sleep_us = SCAN_SLEEP_MIN_US;
+    				ep_scan_listen(SCAN_LISTEN_US);
     			}
 
     			if (radio_dl_received)
     			{
-					SetRTC_WakeupTimeout(RTC_DL_TO_RX_TIME);
+					dl_sync_Reset(POLLINIG_RATE);
+					dl_sync_Received(dl_event_rtc);
+					ep_set_rx_alarm(dl_sync_WakeTime());
     				jv_gpioSet(DBG_GPIO);
 					RTC_set = true;
 					radio_dl_received = false;
 					association_state = ASSOCIATED;
+					ul_frame = 0;
 					ep_send_ble_packet();
+					ep_apply_dl_cmd();
     			}
     			else if ( radio_dl_timeout || radio_dl_err)
     			{
     				jv_gpioSet(DBG_GPIO);
+					bool heard_other = radio_dl_err;
 					radio_dl_timeout = false;
 					radio_dl_err = false;
-					HAL_RADIO_ReceivePacket(BLE_DL_CHANNEL, RX_WAKEUP_TIME, rxBuff, RX_DISASSOC_TOUT, MAX_LL_PACKET_LENGTH, RxCallback);
 					jv_gpioReset(DBG_GPIO);
+					ep_scan_next(heard_other);
     			}
     			break;
     		case ASSOCIATED:
     			if (radio_dl_received)
     			{
-					SetRTC_WakeupTimeout(RTC_DL_TO_RX_TIME);
+					dl_sync_Received(dl_event_rtc);
+					ep_set_rx_alarm(dl_sync_WakeTime());
     				jv_gpioSet(DBG_GPIO);
 					RTC_set = true;
 					radio_dl_received = false;
 					assoc_dl_fail_cnt = 0;
-					ep_send_ble_packet();
+					if (++ul_frame >= ul_rate_div)
+					{
+						ul_frame = 0;
+						ep_send_ble_packet();
+					}
+					ep_apply_dl_cmd();
     			}
     			else if (radio_dl_err)
     			{
-					SetRTC_WakeupTimeout(RTC_DL_TO_RX_TIME);
+					dl_sync_Missed();
+					ep_set_rx_alarm(dl_sync_WakeTime());
     				jv_gpioSet(DBG_GPIO);
 					RTC_set = true;
 					radio_dl_err = false;
@@ -319,10 +789,13 @@ int main(void)
     					assoc_dl_fail_cnt = 0;
     					state_changed = true;
     					association_state = DISASSOCIATED;
+    					ep_release_slot();
+    					ul_ready = false;
     				}
     				else
     				{
-						SetRTC_WakeupTimeout(RTC_TOUT_TO_RX_TIME);
+						dl_sync_Missed();
+						ep_set_rx_alarm(dl_sync_WakeTime());
 						jv_gpioSet(DBG_GPIO);
 						RTC_set = true;
 						assoc_dl_fail_cnt++;
@@ -333,15 +806,14 @@ int main(void)
     			if (RTC_set)
     			{
     				RTC_set = false;
-#ifdef ENTER_DEEPSTOP
-#else
-    		        while (!RTC_WakeupTimeout_Expired())
-    		        {
-    		            __WFE();
-    		        }
+#ifdef UL_PREENCODE
+    				/* encode the next uplink now, off the downlink to uplink path */
+    				if (!ul_ready && ul_frame + 1 >= ul_rate_div)
+    					ep_build_ble_packet();
 #endif
-    		        DisableRTC_WakeupTimeout();
-					HAL_RADIO_ReceivePacket(BLE_DL_CHANNEL, RX_WAKEUP_TIME, rxBuff, RX_ASSOC_TOUT, MAX_LL_PACKET_LENGTH, RxCallback);
+    		        ep_wait_rx_alarm();
+					HAL_RADIO_ReceivePacket(BLE_DL_CHANNEL, RX_WAKEUP_TIME, rxBuff, dl_sync_RxTimeoutUS(), MAX_LL_PACKET_LENGTH, RxCallback);
+					JV_TRACE_END(JV_TRACE_WAKE_TO_RX);
 					jv_gpioReset(DBG_GPIO);
     			}
     			break;
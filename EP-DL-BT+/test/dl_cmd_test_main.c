@@ -0,0 +1,140 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file dl_cmd_test_main.c
+ * @brief Host test of the downlink command parser
+ * @date 2023-03-27
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Build and run on the host from EP-DL-BT+:
+ *
+ *     gcc -O2 -Iinc -o dl_cmd_test test/dl_cmd_test_main.c
+ *     ./dl_cmd_test
+ *
+ * Each case parses one downlink payload as endpoint LINK_ID / SHORT_ID and
+ * compares what dl_cmd_Take() returns: the mask and the fields it marks.
+ * Covers padding, truncated 2 and 4 Byte commands, broadcast against
+ * targeted commands, DL_CMD_ASSIGN for this and another short ID, unknown
+ * opcodes and overrides. Returns non-zero on a failure.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/dl_cmd.c"
+
+#define LINK_ID  3
+#define SHORT_ID 0xBEEF
+
+#define BC(op)     ((DL_CMD_BROADCAST << 4) | (op))
+#define TO(id, op) (((id) << 4) | (op))
+#define M(op)      (1U << (op))
+
+typedef struct
+{
+    const char *name;
+    uint8_t payload[24];
+    uint8_t payload_len;
+    dl_cmd_t expect; // only the fields in expect.mask are compared
+} case_t;
+
+static const case_t cases[] = {
+    {"empty", {0}, 0, {0}},
+    {"broadcast rate", {BC(DL_CMD_RATE), 4}, 2, {.mask = M(DL_CMD_RATE), .rate_div = 4}},
+    {"targeted here", {TO(LINK_ID, DL_CMD_PHY), 3}, 2, {.mask = M(DL_CMD_PHY), .phy = 3}},
+    {"targeted elsewhere", {TO(LINK_ID + 1, DL_CMD_PHY), 3, BC(DL_CMD_CHANNEL), 37}, 4,
+     {.mask = M(DL_CMD_CHANNEL), .channel = 37}},
+    {"link ID 0", {TO(0, DL_CMD_SLOT), 9}, 2, {0}},
+    {"all 2 Byte opcodes",
+     {BC(DL_CMD_RATE), 2, BC(DL_CMD_PHY), 1, BC(DL_CMD_CHANNEL), 12, BC(DL_CMD_OFFSET), 0xF6, BC(DL_CMD_SLOT), 5,
+      BC(DL_CMD_IMU), DL_CMD_IMU_ON, BC(DL_CMD_FRAME), 8},
+     14,
+     {.mask = M(DL_CMD_RATE) | M(DL_CMD_PHY) | M(DL_CMD_CHANNEL) | M(DL_CMD_OFFSET) | M(DL_CMD_SLOT) | M(DL_CMD_IMU) |
+              M(DL_CMD_FRAME),
+      .rate_div = 2, .phy = 1, .channel = 12, .offset = -10, .slot = 5, .imu = DL_CMD_IMU_ON, .slot_count = 8}},
+    {"later overrides", {BC(DL_CMD_RATE), 2, TO(LINK_ID, DL_CMD_RATE), 7}, 4, {.mask = M(DL_CMD_RATE), .rate_div = 7}},
+    {"padding ends the list", {BC(DL_CMD_RATE), 2, 0x00, 0x00, BC(DL_CMD_PHY), 1}, 6, {.mask = M(DL_CMD_RATE), .rate_div = 2}},
+    {"targeted padding", {TO(LINK_ID, 0), 0x00, BC(DL_CMD_PHY), 1}, 4, {0}},
+    {"truncated 2 Byte", {BC(DL_CMD_RATE), 2, BC(DL_CMD_PHY)}, 3, {.mask = M(DL_CMD_RATE), .rate_div = 2}},
+    {"assign here", {BC(DL_CMD_ASSIGN), 0xEF, 0xBE, 6}, 4, {.mask = M(DL_CMD_ASSIGN), .assign_slot = 6}},
+    {"assign elsewhere", {BC(DL_CMD_ASSIGN), 0xBE, 0xEF, 6, BC(DL_CMD_FRAME), 4}, 6,
+     {.mask = M(DL_CMD_FRAME), .slot_count = 4}},
+    {"assign after slot", {BC(DL_CMD_SLOT), 1, BC(DL_CMD_ASSIGN), 0xEF, 0xBE, 6}, 6,
+     {.mask = M(DL_CMD_SLOT) | M(DL_CMD_ASSIGN), .slot = 1, .assign_slot = 6}},
+    {"slot after assign", {BC(DL_CMD_ASSIGN), 0xEF, 0xBE, 6, BC(DL_CMD_SLOT), 1}, 6,
+     {.mask = M(DL_CMD_SLOT) | M(DL_CMD_ASSIGN), .slot = 1, .assign_slot = 6}},
+    {"assign targeted elsewhere", {TO(LINK_ID + 1, DL_CMD_ASSIGN), 0xEF, 0xBE, 6, BC(DL_CMD_RATE), 3}, 6,
+     {.mask = M(DL_CMD_RATE), .rate_div = 3}},
+    {"truncated assign 3 Byte", {BC(DL_CMD_RATE), 2, BC(DL_CMD_ASSIGN), 0xEF, 0xBE}, 5,
+     {.mask = M(DL_CMD_RATE), .rate_div = 2}},
+    {"truncated assign 2 Byte", {BC(DL_CMD_ASSIGN), 0xEF}, 2, {0}},
+    {"unknown 4 Byte skipped", {BC(9), DL_CMD_RATE, 0xFF, 0xFF, BC(DL_CMD_IMU), DL_CMD_IMU_OFF}, 6,
+     {.mask = M(DL_CMD_IMU), .imu = DL_CMD_IMU_OFF}},
+    {"unknown 4 Byte targeted", {TO(LINK_ID, 15), 0, 0, 0, BC(DL_CMD_CHANNEL), 39}, 6,
+     {.mask = M(DL_CMD_CHANNEL), .channel = 39}},
+};
+
+static int check_case(const case_t *c)
+{
+    uint8_t pdu[DL_CMD_HEADER_LEN + sizeof(c->payload)];
+    dl_cmd_t got = {0};
+    const dl_cmd_t *e = &c->expect;
+    int failed = 0;
+
+    memset(pdu, 0xA5, DL_CMD_HEADER_LEN); // header, AdvA and sequence number are not parsed
+    memcpy(pdu + DL_CMD_HEADER_LEN, c->payload, c->payload_len);
+
+    dl_cmd_Parse(pdu, DL_CMD_HEADER_LEN + c->payload_len, LINK_ID, SHORT_ID);
+    dl_cmd_Take(&got);
+
+    failed |= got.mask != e->mask;
+    failed |= (e->mask & M(DL_CMD_RATE)) && got.rate_div != e->rate_div;
+    failed |= (e->mask & M(DL_CMD_PHY)) && got.phy != e->phy;
+    failed |= (e->mask & M(DL_CMD_CHANNEL)) && got.channel != e->channel;
+    failed |= (e->mask & M(DL_CMD_OFFSET)) && got.offset != e->offset;
+    failed |= (e->mask & M(DL_CMD_SLOT)) && got.slot != e->slot;
+    failed |= (e->mask & M(DL_CMD_ASSIGN)) && got.assign_slot != e->assign_slot;
+    failed |= (e->mask & M(DL_CMD_IMU)) && got.imu != e->imu;
+    failed |= (e->mask & M(DL_CMD_FRAME)) && got.slot_count != e->slot_count;
+
+    if (failed)
+        printf("  %-26s mask %04X, expected %04X\n", c->name, got.mask, e->mask);
+    return failed;
+}
+
+/* the pending set survives until taken, and is empty after */
+static int check_take(void)
+{
+    static const uint8_t pdu[DL_CMD_HEADER_LEN + 4] = {[DL_CMD_HEADER_LEN] = BC(DL_CMD_RATE), 5, BC(DL_CMD_PHY), 2};
+    dl_cmd_t got;
+    int failed = 0;
+
+    dl_cmd_Parse(pdu, DL_CMD_HEADER_LEN + 2, LINK_ID, SHORT_ID);
+    dl_cmd_Parse(pdu, sizeof(pdu), LINK_ID, SHORT_ID);
+    failed |= !dl_cmd_Take(&got) || got.mask != (M(DL_CMD_RATE) | M(DL_CMD_PHY)) || got.rate_div != 5 || got.phy != 2;
+    failed |= dl_cmd_Take(&got);
+
+    if (failed)
+        printf("  take\n");
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    uint32_t errors = 0;
+
+    for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        errors += check_case(&cases[i]);
+    errors += check_take();
+
+    printf("dl_cmd   %3u cases  %s\n", (unsigned)(sizeof(cases) / sizeof(cases[0])) + 1, errors ? "FAIL" : "PASS");
+    return errors != 0;
+}
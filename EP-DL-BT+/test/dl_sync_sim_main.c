@@ -0,0 +1,116 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file dl_sync_sim_main.c
+ * @brief Host simulation of the downlink timing tracker against a drifting reader
+ * @date 2023-03-22
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Build and run on the host from EP-DL-BT+:
+ *
+ *     gcc -O2 -I. -Iinc -o dl_sync_sim test/dl_sync_sim_main.c
+ *     ./dl_sync_sim
+ *
+ * The reader sends a downlink every POLLINIG_RATE us of its own clock, the RTC
+ * runs 80 ppm fast or slow against it, and the RX timestamp has +-1 tick of
+ * noise. One run also loses 5% of the downlinks. Each frame the endpoint wakes
+ * at dl_sync_WakeTime(), listens for dl_sync_RxTimeoutUS() and hears the
+ * downlink only if it arrives inside that window. The RTC tick counter wraps
+ * during the run. Prints the settled window and returns non-zero if a sent
+ * downlink is missed or the window does not settle below RX_ASSOC_TOUT.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "main.h"
+
+/* jv_rtc.h pulls in the SDK, the tracker only needs the tick conversions */
+#define INC_RTC_H_
+#define RTC_TICKS_PER_SEC       16384
+#define RTC_US_TO_TICKS(us)     ((uint32_t)(((uint64_t)(us) * RTC_TICKS_PER_SEC) / 1000000))
+#define RTC_TICKS_TO_US(ticks)  ((uint32_t)(((uint64_t)(ticks) * 1000000) / RTC_TICKS_PER_SEC))
+
+#include "../src/dl_sync.c"
+
+#define FRAMES      2000
+#define SETTLED     100        // frames before the window is judged
+#define START_TICKS 0xFFFF0000 // wraps after ~160 frames
+
+typedef struct
+{
+    const char *name;
+    double drift_ppm;
+    int loss_pct; // downlinks the reader does not get through
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"fast", 80, 0},
+    {"slow", -80, 0},
+    {"lossy", 80, 5},
+};
+
+static int run(const scenario_t *s)
+{
+    double period = POLLINIG_RATE * RTC_TICKS_PER_SEC / 1e6 * (1 + s->drift_ppm * 1e-6);
+    uint32_t sent = 0, heard = 0, missed = 0;
+    uint32_t window_min = UINT32_MAX, window_max = 0;
+
+    srand(1);
+    dl_sync_Reset(POLLINIG_RATE);
+    dl_sync_Received(START_TICKS); // associated on frame 0
+
+    for (uint32_t frame = 1; frame < FRAMES; frame++)
+    {
+        double arrival = START_TICKS + frame * period;                 // RTC ticks, not wrapped
+        double open = (double)((uint64_t)START_TICKS + (uint32_t)(dl_sync_WakeTime() - START_TICKS)) +
+                      RX_WAKEUP_TIME * RTC_TICKS_PER_SEC / 1e6;
+        uint32_t window_us = dl_sync_RxTimeoutUS();
+        double close = open + window_us * RTC_TICKS_PER_SEC / 1e6;
+
+        if (frame >= SETTLED)
+        {
+            if (window_us < window_min)
+                window_min = window_us;
+            if (window_us > window_max)
+                window_max = window_us;
+        }
+
+        if (rand() % 100 < s->loss_pct)
+        {
+            dl_sync_Missed();
+            continue;
+        }
+        sent++;
+        if (arrival < open || arrival > close)
+        {
+            missed++;
+            dl_sync_Missed();
+            continue;
+        }
+        heard++;
+        dl_sync_Received((uint32_t)((uint64_t)arrival + rand() % 3 - 1));
+    }
+
+    int failed = missed != 0 || window_max >= RX_ASSOC_TOUT;
+    printf("%-6s %+4.0f ppm %2d%% lost  %4u sent %4u heard %3u missed  window %4u-%4u us  %s\n",
+           s->name, s->drift_ppm, s->loss_pct, sent, heard, missed, window_min, window_max, failed ? "FAIL" : "PASS");
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    int failed = 0;
+
+    for (uint32_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        failed |= run(&scenarios[i]);
+
+    return failed;
+}
@@ -23,7 +23,11 @@
  * Application parameters
  *
  * Packet Rate:
- *     To configure output packet rate, configure RTC_DELAY
+ *     To configure output packet rate, configure PACKET_RATE_HZ
+ *     Any integer rate works, the packet timer dithers whole ~61 us ticks so the
+ *     average rate is exact. Change it at runtime with
+ *     jv_timer_SetPeriod(&packet_timer, JV_TIMER_PERIOD_HZ(hz)), not with the
+ *     RTC_Scheduler functions, they share the RTC alarm with jv_timer.
  *
  * BLE Bit Rate:
  *     Configure BLE_PHY to 125, 500, 1000, or 2000 for
@@ -38,29 +42,48 @@
  *     Enable periodic blinking of onboard LED by uncommenting LED_BLINK
  *     LED turns on every LED_ON_THRESHOLD packets
  *     LED then turns off after LED_OFF_THRESHOLD packets
+ *     Both run on their own software timers, the period must be under 4 s
+ *     If imu_init() fails the LED toggles every IMU_FAULT_BLINK_US instead and no packets
+ *     are sent.
+ *
+ * Scheduling:
+ *     Packet, IMU warm-up and LED events are software timers on the RTC alarm (jv_timer.h).
+ *     IMU_WARMUP_US: IMU is powered on this long before each packet
+ *     DEEPSTOP_MIN_TICKS: shorter sleeps use CPU HALT (WFE) instead of DEEPSTOP
+ *
+ * Debug Options:
+ *     JV_TRACE: record per-stage cycle counts (PDU build, CRC/whiten, FEC, upscale,
+ *         DMA, IMU read, RTC wait) into a .noinit trace buffer, see jv_trace.h
  *
  */
 
 /**********************/
 /* User configuration */
 /**********************/
-#define RTC_DELAY          RTC_DELAY_60HZ
+#define PACKET_RATE_HZ     60
 #define BLE_CHANNEL 0
 #define BLE_PHY 500 // 125, 500, 1000, or 2000
 // #define LED_BLINK            true
 // #define LED_ON_THRESHOLD     220
 // #define LED_OFF_THRESHOLD    2
+// #define JV_TRACE             true
 
 /* Other application defines */
-#define RTC_DELAY_1HZ   16384
-#define RTC_DELAY_10HZ  1638
-#define RTC_DELAY_30HZ  546
-#define RTC_DELAY_60HZ  273
-#define RTC_DELAY_90HZ  182
-#define RTC_DELAY_120HZ 137
-#define RTC_DELAY_144HZ 114
-#define RTC_DELAY_200HZ 82
-#define RTC_DELAY_240HZ 68
+#define IMU_WARMUP_US      500
+#define DEEPSTOP_MIN_TICKS 16 // RTC ticks, ~1 ms
+#define IMU_FAULT_BLINK_US 50000 // LED toggle period when imu_init() fails, jv_delayUS() range
+
+#define IMU_WARMUP_TICKS RTC_US_TO_TICKS(IMU_WARMUP_US)
+#define LED_OFF_TICKS    RTC_US_TO_TICKS(LED_OFF_THRESHOLD * 1000000ULL / PACKET_RATE_HZ)
+
+#if PACKET_RATE_HZ < 1 || PACKET_RATE_HZ > 8192
+#error "PACKET_RATE_HZ must be 1 to 8192 Hz, at least two RTC ticks per packet"
+#endif
+
+/* JV_TIMER_PERIOD_US() is 16.16 RTC ticks, 4 s overflows it */
+#if defined LED_BLINK && LED_ON_THRESHOLD * 1000000ULL / PACKET_RATE_HZ >= 4000000
+#error "LED_ON_THRESHOLD packets must take under 4 s"
+#endif
 
 #define USE_RTC        true
 #define USE_IMU        true
@@ -71,20 +94,20 @@
 #define XL_ODR LSM6DSO32_XL_ODR_6667Hz_HIGH_PERF
 #define GY_ODR LSM6DSO32_GY_ODR_6667Hz_HIGH_PERF
 #else
-#if RTC_DELAY == RTC_DELAY_1HZ || RTC_DELAY == RTC_DELAY_10HZ || RTC_DELAY == RTC_DELAY_30HZ
+#if PACKET_RATE_HZ <= 50
 #define XL_ODR LSM6DSO32_XL_ODR_52Hz_LOW_PW
 #define GY_ODR LSM6DSO32_GY_ODR_52Hz_LOW_PW
-#elif RTC_DELAY == RTC_DELAY_60HZ || RTC_DELAY == RTC_DELAY_90HZ
+#elif PACKET_RATE_HZ <= 100
 #define XL_ODR LSM6DSO32_XL_ODR_104Hz_NORMAL_MD
 #define GY_ODR LSM6DSO32_GY_ODR_104Hz_NORMAL_MD
-#elif RTC_DELAY == RTC_DELAY_120HZ || RTC_DELAY == RTC_DELAY_144HZ || RTC_DELAY == RTC_DELAY_200HZ
+#elif PACKET_RATE_HZ <= 200
 #define XL_ODR LSM6DSO32_XL_ODR_208Hz_NORMAL_MD
 #define GY_ODR LSM6DSO32_GY_ODR_208Hz_NORMAL_MD
-#elif RTC_DELAY == RTC_DELAY_240HZ
+#elif PACKET_RATE_HZ <= 240
 #define XL_ODR LSM6DSO32_XL_ODR_417Hz_HIGH_PERF
 #define GY_ODR LSM6DSO32_GY_ODR_417Hz_HIGH_PERF
 #else
-#error "RTC_DELAY invalid"
+#error "PACKET_RATE_HZ invalid"
 #endif
 #endif
 
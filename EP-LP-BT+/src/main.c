@@ -20,16 +20,16 @@
 #include "main.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_spi_bsc.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_rtc.h"
+#include "../lib/jv_BlueNRG-LP_lib/jv_timer.h"
 #include "../lib/jv_BlueNRG-LP_lib/jv_gpio.h"
+#include "../lib/jv_BlueNRG-LP_lib/jv_delayUS.h"
+#include "../lib/jv_BlueNRG-LP_lib/jv_trace.h"
 #include "../lib/jv_LSM6DSO32_lib/jv_imu.h"
 #include "../lib/jv_bt+packet_lib/jv_bt+packet.h"
 #include "../lib/jv_bt+packet_lib/jv_bt+bsc.h"
 
 /* IMU SPI communication */
 SPI_HandleTypeDef hspiMaster;
-__attribute((aligned(4))) uint8_t aTxBuffer[32];                // Buffer used for transmission;
-uint8_t ubNbDataToTransmit = sizeof(aTxBuffer);                 // Data length to transmit
-__attribute((aligned(4))) uint8_t aRxBuffer[sizeof(aTxBuffer)]; // Buffer used for reception
 
 /* flags for SPI and RTC interrupts */
 volatile uint8_t data_ready = 0;
@@ -46,7 +46,126 @@ size_t coded_len;
 uint32_t packet_upscaled[2500];
 uint32_t upscaled_length;
 
-/**e
+/* IMU */
+stmdev_ctx_t dev_ctx;
+int32_t result = 0;
+
+/* software timers, all on the RTC alarm */
+jv_timer_t packet_timer;
+jv_timer_t imu_timer;
+#ifdef LED_BLINK
+jv_timer_t led_on_timer;
+jv_timer_t led_off_timer;
+#endif
+
+/**
+ * @brief Power on the IMU ahead of the packet so its first sample is ready by then
+ *
+ */
+static void imu_warmup_cb(void *arg)
+{
+    result |= imu_power_on(&dev_ctx);
+    imu_interrupt_enable();
+    data_ready = 0;
+}
+
+/**
+ * @brief No IMU on the bus: blink the LED fast instead of sending packets without data
+ *
+ */
+static void imu_fault(void)
+{
+    while (1)
+    {
+        led_toggle();
+        jv_delayUS(IMU_FAULT_BLINK_US);
+    }
+}
+
+#ifdef LED_BLINK
+static void led_off_cb(void *arg)
+{
+    led_off();
+}
+
+static void led_on_cb(void *arg)
+{
+    led_on();
+    jv_timer_Start(&led_off_timer, RTC_GetTicks() + LED_OFF_TICKS, 0, led_off_cb, NULL);
+}
+#endif
+
+/**
+ * @brief Send the encoded packet, then read the IMU and encode the next one
+ *
+ */
+static void packet_cb(void *arg)
+{
+    static uint16_t count = 0;
+
+    /* start transmission */
+    JV_TRACE_BEGIN(JV_TRACE_DMA_START);
+    SPI_DMA_Reinit((uint32_t)packet_upscaled, upscaled_length);
+    SPI_DMA_Activate();
+    JV_TRACE_END(JV_TRACE_DMA_START);
+
+    /* read buttons - deprecated */
+    AdvData[0] = 0x00;
+
+    /* update sequence number */
+    AdvData[1] = (uint8_t)count;
+    AdvData[2] = (uint8_t)(count >> 8);
+
+    /* increment sequence number */
+    count++;
+
+    /* wait for data ready interrupt, normally already there after the warm-up */
+    while (data_ready != 1)
+    {
+        __WFE();
+    }
+    imu_interrupt_disable();
+
+    /* get IMU data */
+    JV_TRACE_BEGIN(JV_TRACE_IMU_READ);
+    result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+    JV_TRACE_END(JV_TRACE_IMU_READ);
+
+    /* power off IMU until the next warm-up */
+    result |= imu_power_off(&dev_ctx);
+    jv_timer_Start(&imu_timer, jv_timer_Deadline(&packet_timer) - IMU_WARMUP_TICKS, 0, imu_warmup_cb, NULL);
+
+    /* update payload */
+    JV_TRACE_BEGIN(JV_TRACE_PDU_BUILD);
+    create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA) / sizeof(AdvA[0]), AdvData, sizeof(AdvData) / sizeof(AdvData[0]));
+    JV_TRACE_END(JV_TRACE_PDU_BUILD);
+
+    /* wait for transmission to be complete */
+    while (!DMA_SPI_TransmitCompleted())
+    {
+        __WFE();
+    }
+    SPI_DMA_Uninit();
+
+    /* update packet */
+    JV_TRACE_BEGIN(JV_TRACE_CRC_WHITEN);
+    update_advertising_packet(&packet, &pdu);
+    JV_TRACE_END(JV_TRACE_CRC_WHITEN);
+#ifdef BLE_CODED
+    JV_TRACE_BEGIN(JV_TRACE_FEC);
+    coded_len = encode_packet(coded_buf, &packet);
+    JV_TRACE_END(JV_TRACE_FEC);
+    JV_TRACE_BEGIN(JV_TRACE_UPSCALE);
+    upscaled_length = jv_bsc_upscale(packet_upscaled, coded_buf, coded_len);
+    JV_TRACE_END(JV_TRACE_UPSCALE);
+#else
+    JV_TRACE_BEGIN(JV_TRACE_UPSCALE);
+    upscaled_length = jv_bsc_upscale(packet_upscaled, packet.whitened_packet, packet.packet_len);
+    JV_TRACE_END(JV_TRACE_UPSCALE);
+#endif
+}
+
+/**
  * @brief Main function
  *
  */
@@ -64,15 +183,15 @@ int main(void)
     /* IMU SPI config */
     HAL_Init();
     MX_SPI_MASTER_Init();
-    stmdev_ctx_t dev_ctx;
-    int32_t result = 0;
     dev_ctx.write_reg = platform_write;
     dev_ctx.read_reg = platform_read;
     dev_ctx.handle = &hspiMaster;
-    result |= imu_init(&dev_ctx);
+    jv_delayUS_Init(); // times the imu_init() polling
+    if (imu_init(&dev_ctx) != 0)
+        imu_fault(); // the IMU reads below would never see data
     result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
+    result |= imu_power_off(&dev_ctx);
     imu_interrupt_init();
-    imu_interrupt_enable();
 
     /* BLE packet / BSC SPI init */
     AdvData[1] = 0x00;
@@ -95,78 +214,45 @@ int main(void)
     PowerSaveLevels stopLevel;
     wakeupIO.RTC_enable = 1;
 
-    /* start timer */
-    RTC_WakeupInit();
-    SetRTC_WakeupTimeout(RTC_DELAY);
+    /* stage tracing, after HAL_Init() which starts the SysTick tick */
+    JV_TRACE_INIT();
 
-    /* infinite program loop */
-    uint16_t count = 0;
+    /* start timers */
+    RTC_WakeupInit();
+    jv_timeUS_Init();
+    uint32_t start = RTC_GetTicks() + JV_TIMER_PERIOD_HZ(PACKET_RATE_HZ) / 65536;
+    jv_timer_Start(&packet_timer, start, JV_TIMER_PERIOD_HZ(PACKET_RATE_HZ), packet_cb, NULL);
+    jv_timer_Start(&imu_timer, start - IMU_WARMUP_TICKS, 0, imu_warmup_cb, NULL);
+#ifdef LED_BLINK
+    jv_timer_Start(&led_on_timer, start, JV_TIMER_PERIOD_US(LED_ON_THRESHOLD * 1000000ULL / PACKET_RATE_HZ), led_on_cb, NULL);
+#endif
 
+    /* infinite program loop, every wake runs whatever timers are due */
     while (1)
     {
-        /* power on IMU */
-        result |= imu_power_on(&dev_ctx);
-        imu_interrupt_enable();
-        data_ready = 0;
-        /* start transmission */
-        SPI_DMA_Reinit((uint32_t)packet_upscaled, upscaled_length);
-        SPI_DMA_Activate();
-
-        /* read buttons - deprecated */
-        AdvData[0] = 0x00;
-
-        /* update sequence number */
-        AdvData[1] = (uint8_t)count;
-        AdvData[2] = (uint8_t)(count >> 8);
-
-        /* increment sequence number */
-        count++;
-
-        /* blink LED */
-#ifdef LED_BLINK
-        if (count % LED_ON_THRESHOLD == 0)
-            led_on();
-        else if (count % LED_ON_THRESHOLD == LED_OFF_THRESHOLD)
-            led_off();
-#endif
+        jv_timer_Dispatch();
 
-        /* wait for data ready interrupt */
-        while (data_ready != 1)
+        if (jv_timer_TicksToNext() > DEEPSTOP_MIN_TICKS)
         {
-            __WFE();
+            ret_val = HAL_PWR_MNGR_Request(POWER_SAVE_LEVEL_STOP_WITH_TIMER, wakeupIO, &stopLevel);
+            if (ret_val != SUCCESS)
+                while (1)
+                    ;
+            SPI_DMA_Init((uint32_t)packet_upscaled, upscaled_length);
+            HAL_SPI_DeInit(&hspiMaster); // SPI2 is not retained either, back to reset state so the init restores clock and pins
+            MX_SPI_MASTER_Init();
+            JV_TRACE_INIT(); // SysTick is not retained in DEEPSTOP
+            jv_timeUS_Resync();
         }
-        imu_interrupt_disable();
-
-        /* get IMU data */
-        result |= imu_get_packet_data(&dev_ctx, (uint16_t *)(&AdvData[4]));
-
-        /* power off IMU */
-        result |= imu_power_off(&dev_ctx);
-
-        /* update payload */
-        create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA) / sizeof(AdvA[0]), AdvData, sizeof(AdvData) / sizeof(AdvData[0]));
-
-        /* wait for transmission to be complete */
-        while (!DMA_SPI_TransmitCompleted())
+        else
         {
-            __WFE();
+            /* too close for DEEPSTOP, e.g. IMU warm-up to packet */
+            JV_TRACE_BEGIN(JV_TRACE_RTC_WAIT);
+            while (!RTC_Alarm_Expired())
+            {
+                __WFE();
+            }
+            JV_TRACE_END(JV_TRACE_RTC_WAIT);
         }
-        SPI_DMA_Uninit();
-
-        /* update packet */
-        update_advertising_packet(&packet, &pdu);
-#ifdef BLE_CODED
-        coded_len = encode_packet(coded_buf, &packet);
-        upscaled_length = jv_bsc_upscale(packet_upscaled, coded_buf, coded_len);
-#else
-        upscaled_length = jv_bsc_upscale(packet_upscaled, packet.whitened_packet, packet.packet_len);
-#endif
-
-        /* wait for timer to be complete */
-        ret_val = HAL_PWR_MNGR_Request(POWER_SAVE_LEVEL_STOP_WITH_TIMER, wakeupIO, &stopLevel);
-        if (ret_val != SUCCESS)
-            while (1)
-                ;
-        SPI_DMA_Init((uint32_t)packet_upscaled, upscaled_length);
     }
 }
@@ -14,11 +14,69 @@
  *
  */
 #include "rf_driver_hal.h"
+#include "rf_driver_ll_bus.h"
+#include "rf_driver_ll_tim.h"
 #include <stdbool.h>
+#include "jv_delayUS.h"
+#include "jv_rtc.h"
 
 TIM_HandleTypeDef htimx;
 volatile bool time_elapsed = false;
 
+/* Microsecond timebase: TIM2 free running at 1 MHz, re-anchored to the RTC after sleep */
+static volatile uint32_t tim_epoch_us;  // time at the last TIM2 counter wrap
+static uint32_t last_us;                // last value returned, keeps the time monotonic
+static uint32_t rtc_sync_ticks;         // RTC time of the last anchor
+static uint32_t rtc_sync_us;            //  and the same instant in us
+static uint32_t rtc_sync_rem;           //  plus the remainder in 1/256 us
+static volatile uint32_t until_deadline;
+static volatile bool until_armed = false;
+static volatile bool until_expired = false;
+
+static void jv_timeUS_Start(uint32_t now_us)
+{
+    LL_APB0_EnableClock(LL_APB0_PERIPH_TIM2);
+    LL_TIM_DisableCounter(TIM2);
+    LL_TIM_SetPrescaler(TIM2, (HAL_TIM_GetPeriphClock(TIM2) / 1000000) - 1);
+    LL_TIM_SetCounterMode(TIM2, LL_TIM_COUNTERMODE_UP);
+    LL_TIM_SetAutoReload(TIM2, 0xFFFF);
+    LL_TIM_SetUpdateSource(TIM2, LL_TIM_UPDATESOURCE_COUNTER);
+    LL_TIM_GenerateEvent_UPDATE(TIM2); // load the prescaler
+    LL_TIM_SetCounter(TIM2, now_us & 0xFFFF);
+    tim_epoch_us = now_us & ~0xFFFFUL;
+    LL_TIM_ClearFlag_UPDATE(TIM2);
+    LL_TIM_EnableIT_UPDATE(TIM2);
+    NVIC_SetPriority(TIM2_IRQn, IRQ_HIGH_PRIORITY);
+    NVIC_EnableIRQ(TIM2_IRQn);
+    LL_TIM_EnableCounter(TIM2);
+}
+
+/* Load CC1 if the deadline falls before the next counter wrap, the update interrupt rechecks otherwise */
+static void jv_delayUntilUS_Compare(void)
+{
+    uint32_t remaining = until_deadline - jv_timeUS();
+
+    if ((int32_t)remaining <= 0)
+    {
+        LL_TIM_DisableIT_CC1(TIM2);
+        until_armed = false;
+        until_expired = true;
+    }
+    else if (remaining < 0x10000 - (LL_TIM_GetCounter(TIM2) & 0xFFFF))
+    {
+        LL_TIM_OC_SetCompareCH1(TIM2, until_deadline & 0xFFFF);
+        LL_TIM_ClearFlag_CC1(TIM2);
+        LL_TIM_EnableIT_CC1(TIM2);
+        /* counter may have passed the compare value while it was loaded */
+        if ((int32_t)(until_deadline - jv_timeUS()) <= 0)
+        {
+            LL_TIM_DisableIT_CC1(TIM2);
+            until_armed = false;
+            until_expired = true;
+        }
+    }
+}
+
 
 int jv_delayUS_Init(void)
 {
@@ -70,6 +128,107 @@ void jv_delayUS(uint16_t us)
 	HAL_TIM_Base_Stop_IT(&htimx);
 }
 
+int jv_timeUS_Init(void)
+{
+    rtc_sync_ticks = RTC_GetTicks();
+    rtc_sync_us = 0;
+    rtc_sync_rem = 0;
+    last_us = 0;
+    jv_timeUS_Start(0);
+    return 0;
+}
+
+void jv_timeUS_Resync(void)
+{
+    uint32_t now_ticks = RTC_GetTicks();
+    uint64_t scaled = (uint64_t)(now_ticks - rtc_sync_ticks) * 15625 + rtc_sync_rem; // 1e6 / 16384 = 15625 / 256
+    uint32_t now_us;
+
+    rtc_sync_ticks = now_ticks;
+    rtc_sync_us += (uint32_t)(scaled >> 8);
+    rtc_sync_rem = (uint32_t)scaled & 0xFF;
+
+    /* TIM2 lost its count in DEEPSTOP, restart it from the RTC, never going backwards */
+    now_us = (int32_t)(rtc_sync_us - last_us) > 0 ? rtc_sync_us : last_us;
+    jv_timeUS_Start(now_us);
+    if (until_armed)
+        jv_delayUntilUS_Compare();
+}
+
+uint32_t jv_timeUS(void)
+{
+    uint32_t epoch, cnt, now;
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    epoch = tim_epoch_us;
+    cnt = LL_TIM_GetCounter(TIM2) & 0xFFFF;
+    /* wrapped, but the update interrupt has not run yet */
+    if (LL_TIM_IsActiveFlag_UPDATE(TIM2) && cnt < 0x8000)
+        epoch += 0x10000;
+    now = epoch + cnt;
+    if ((int32_t)(now - last_us) > 0)
+        last_us = now;
+    now = last_us;
+    __set_PRIMASK(primask);
+    return now;
+}
+
+void jv_delayUntilUS_Start(uint32_t deadline)
+{
+    until_deadline = deadline;
+    until_expired = false;
+    until_armed = true;
+    jv_delayUntilUS_Compare();
+}
+
+bool jv_delayUntilUS_Expired(void)
+{
+    if (until_expired)
+    {
+        until_expired = false;
+        return true;
+    }
+    return false;
+}
+
+void jv_delayUntilUS(uint32_t deadline)
+{
+    jv_delayUntilUS_Start(deadline);
+    while (!jv_delayUntilUS_Expired())
+    {
+        __WFE();
+    }
+}
+
+/**
+* @brief This function handles TIM1 global interrupt.
+*/
+void TIM1_IRQHandler(void)
+{
+	HAL_TIM_IRQHandler(&htimx);
+}
+
+/**
+* @brief This function handles TIM2 global interrupt, extends the counter and ends jv_delayUntilUS()
+*/
+void TIM2_IRQHandler(void)
+{
+    if (LL_TIM_IsActiveFlag_UPDATE(TIM2))
+    {
+        LL_TIM_ClearFlag_UPDATE(TIM2);
+        tim_epoch_us += 0x10000;
+        if (until_armed)
+            jv_delayUntilUS_Compare();
+    }
+    if (LL_TIM_IsActiveFlag_CC1(TIM2))
+    {
+        LL_TIM_ClearFlag_CC1(TIM2);
+        if (until_armed)
+            jv_delayUntilUS_Compare();
+    }
+}
+
 /**
 * @brief TIM_Base MSP Initialization
 * @param htim_base: TIM_Base handle pointer
@@ -17,6 +17,9 @@
 #ifndef INC_JV_DELAYUS_H
 #define INC_JV_DELAYUS_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 /**
 * @brief jv_delayUS Initialization Function
 * @param None
@@ -31,4 +34,46 @@ int jv_delayUS_Init(void);
 */
 void jv_delayUS(uint16_t us);
 
+/**
+* @brief  Start the 32 bit microsecond timebase on TIM2, after RTC_WakeupInit()
+* @param  None
+* @retval success = 0, error = -1
+*/
+int jv_timeUS_Init(void);
+
+/**
+* @brief  Re-anchor the timebase to the RTC, call after every DEEPSTOP wake
+* @param  None
+* @retval None
+*/
+void jv_timeUS_Resync(void);
+
+/**
+* @brief  Monotonic time, 1 us resolution while running, wraps after ~71 minutes
+* @param  None
+* @retval time in microseconds, compare by subtraction
+*/
+uint32_t jv_timeUS(void);
+
+/**
+* @brief  Start a non-blocking wait until an absolute jv_timeUS() value
+* @param  deadline : time in microseconds
+* @retval None
+*/
+void jv_delayUntilUS_Start(uint32_t deadline);
+
+/**
+* @brief  Check if the wait started by jv_delayUntilUS_Start() is over
+* @param  None
+* @retval true once per deadline
+*/
+bool jv_delayUntilUS_Expired(void);
+
+/**
+* @brief  Sleep in CPU HALT until an absolute jv_timeUS() value
+* @param  deadline : time in microseconds
+* @retval None
+*/
+void jv_delayUntilUS(uint32_t deadline);
+
 #endif /* INC_JV_DELAYUS_H */
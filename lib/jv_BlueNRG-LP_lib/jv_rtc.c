@@ -23,7 +23,118 @@
 #include "system_BlueNRG_LP.h"
 
 
+#define RTC_PREDIV_S    (RTC_TICKS_PER_SEC - 1)
+#define RTC_DAY_TICKS   (86400UL * RTC_TICKS_PER_SEC)
+
 static volatile bool RTC_WU_Completed;
+static volatile bool RTC_ALARM_Completed;
+
+/* Timebase, extends the time of day to a 32 bit tick count */
+static uint32_t rtc_day_base = 0;
+static uint32_t rtc_last_tod = 0;
+static volatile uint32_t alarm_deadline;
+static volatile uint32_t alarm_timestamp;
+
+/* Packet scheduler, next deadline in ticks plus a 16 bit fraction */
+static volatile uint32_t sched_period_q16;
+static uint32_t sched_next;
+static uint16_t sched_frac;
+static volatile bool sched_running = false;
+
+static void RTC_WakeupProgram(uint32_t reload)
+{
+    LL_RTC_DisableWriteProtection(RTC);                    // Disable write protection
+    LL_RTC_WAKEUP_Disable(RTC);                            // Disable Wake-up Timer
+    LL_RTC_DisableIT_WUT(RTC);                             // In case of interrupt mode is used, the interrupt source must disabled
+    while (LL_RTC_IsActiveFlag_WUTW(RTC) == 0)             // Wait till RTC WUTWF flag is set
+        ;                                                  //
+    LL_PWR_ClearWakeupSource(LL_PWR_EWS_INT);              // Clear PWR wake up Flag
+    LL_RTC_ClearFlag_WUT(RTC);                             // Clear RTC Wake Up timer Flag
+    LL_RTC_WAKEUP_SetAutoReload(RTC, reload);              // Configure the Wake-up Timer counter
+    LL_RTC_EnableIT_WUT(RTC);                              // Configure the Interrupt in the RTC_CR register
+    LL_RTC_WAKEUP_Enable(RTC);                             // Enable the Wake-up Timer
+    LL_RTC_EnableWriteProtection(RTC);                     // Enable write protection
+}
+
+/* Ticks since midnight, the shadow registers are bypassed so read until two reads agree */
+static uint32_t RTC_ReadTimeOfDay(void)
+{
+    uint32_t ss, tr;
+
+    do
+    {
+        ss = LL_RTC_TIME_GetSubSecond(RTC);
+        tr = LL_RTC_TIME_Get(RTC);
+    } while (ss != LL_RTC_TIME_GetSubSecond(RTC) || tr != LL_RTC_TIME_Get(RTC));
+
+    return ((__LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_HOUR(tr)) * 3600UL +
+             __LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_MINUTE(tr)) * 60UL +
+             __LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_SECOND(tr))) * RTC_TICKS_PER_SEC) +
+           (RTC_PREDIV_S - ss);
+}
+
+/* Load alarm A with an absolute deadline, -1 if it is not at least RTC_ALARM_MIN_LEAD ahead,
+ * -2 if the alarm registers do not unlock */
+static int RTC_AlarmProgram(uint32_t deadline)
+{
+    uint32_t now = RTC_GetTicks();
+    uint32_t lead = deadline - now;
+    uint32_t tod, sec;
+    uint32_t spin = RTC_ALRAW_SPIN_MAX;
+
+    if ((int32_t)lead < RTC_ALARM_MIN_LEAD || lead >= RTC_DAY_TICKS)
+        return -1;
+    tod = (now - rtc_day_base + lead) % RTC_DAY_TICKS;
+    sec = tod / RTC_TICKS_PER_SEC;
+    alarm_deadline = deadline;
+
+    LL_RTC_DisableWriteProtection(RTC);                    // Disable write protection
+    LL_RTC_ALMA_Disable(RTC);                              // Disable Alarm A
+    LL_RTC_DisableIT_ALRA(RTC);                            //
+    while (LL_RTC_IsActiveFlag_ALRAW(RTC) == 0)            // Set within two RTC clocks of the disable
+    {                                                      //
+        if (--spin == 0)                                   //
+        {                                                  //
+            LL_RTC_EnableWriteProtection(RTC);             // alarm stays disabled
+            return -2;                                     //
+        }                                                  //
+    }                                                      //
+    LL_PWR_ClearWakeupSource(LL_PWR_EWS_INT);              // Clear PWR wake up Flag
+    LL_RTC_ClearFlag_ALRA(RTC);                            // Clear RTC Alarm A Flag
+    LL_RTC_ALMA_SetMask(RTC, LL_RTC_ALMA_MASK_DATEWEEKDAY); // Compare time of day and subseconds
+    LL_RTC_ALMA_ConfigTime(RTC, LL_RTC_ALMA_TIME_FORMAT_AM,
+                           __LL_RTC_CONVERT_BIN2BCD(sec / 3600),
+                           __LL_RTC_CONVERT_BIN2BCD((sec / 60) % 60),
+                           __LL_RTC_CONVERT_BIN2BCD(sec % 60));
+    LL_RTC_ALMA_SetSubSecondMask(RTC, 14);                 // SS[13:0], all of PREDIV_S
+    LL_RTC_ALMA_SetSubSecond(RTC, RTC_PREDIV_S - (tod % RTC_TICKS_PER_SEC));
+    LL_RTC_EnableIT_ALRA(RTC);                             // Configure the Interrupt in the RTC_CR register
+    LL_RTC_ALMA_Enable(RTC);                               // Enable Alarm A
+    LL_RTC_EnableWriteProtection(RTC);                     // Enable write protection
+    return 0;
+}
+
+/* Move to the next deadline on the fractional grid, skipping any that are already missed */
+static int RTC_Scheduler_Advance(void)
+{
+    int status;
+
+    if (sched_period_q16 == 0)
+    {
+        sched_running = false; // never set, the grid would not move
+        return -1;
+    }
+    do
+    {
+        uint32_t frac = (uint32_t)sched_frac + (sched_period_q16 & 0xFFFF);
+        sched_next += (sched_period_q16 >> 16) + (frac >> 16);
+        sched_frac = (uint16_t)frac;
+        status = RTC_AlarmProgram(sched_next);
+    } while (status == -1);
+    if (status != 0)
+        sched_running = false; // alarm registers locked, do not spin in the interrupt
+    return status;
+}
 
 void RTC_WakeupInit(void)
 {
@@ -41,9 +152,10 @@ void RTC_WakeupInit(void)
     LL_RTC_SetHourFormat(RTC, LL_RTC_HOURFORMAT_24HOUR);           // Configure Hour Format
     LL_RTC_SetAlarmOutEvent(RTC, LL_RTC_ALARMOUT_DISABLE);         // Output disabled
     LL_RTC_SetOutputPolarity(RTC, LL_RTC_OUTPUTPOLARITY_PIN_HIGH); // Output polarity
-    LL_RTC_SetAsynchPrescaler(RTC, 0x7F);                          // Set Asynchronous prescaler factor
-    LL_RTC_SetSynchPrescaler(RTC, 0x00FF);                         // Set Synchronous prescaler factor
+    LL_RTC_SetAsynchPrescaler(RTC, 0x01);                          // Set Asynchronous prescaler factor, SSR counts at 16384 Hz
+    LL_RTC_SetSynchPrescaler(RTC, RTC_PREDIV_S);                   // Set Synchronous prescaler factor, 1 Hz calendar
     LL_RTC_DisableInitMode(RTC);                                   // Exit Initialization mode
+    LL_RTC_EnableShadowRegBypass(RTC);                             // Read the counters directly, also right after DEEPSTOP
     LL_RTC_WAKEUP_SetClock(RTC, LL_RTC_WAKEUPCLOCK_DIV_2); 		// Configure the clock source
     LL_RTC_EnableWriteProtection(RTC);                     		// Enable write protection
     NVIC_SetPriority(RTC_IRQn, IRQ_LOW_PRIORITY);          		// Configure NVIC for RTC
@@ -53,17 +165,7 @@ void RTC_WakeupInit(void)
 void SetRTC_WakeupTimeout(uint32_t time)
 {
     RTC_WU_Completed = false;
-    LL_RTC_DisableWriteProtection(RTC);                    // Disable write protection
-    LL_RTC_WAKEUP_Disable(RTC);                            // Disable Wake-up Timer
-    LL_RTC_DisableIT_WUT(RTC);                             // In case of interrupt mode is used, the interrupt source must disabled
-    while (LL_RTC_IsActiveFlag_WUTW(RTC) == 0)             // Wait till RTC WUTWF flag is set
-        ;                                                  //
-    LL_PWR_ClearWakeupSource(LL_PWR_EWS_INT);              // Clear PWR wake up Flag
-    LL_RTC_ClearFlag_WUT(RTC);                             // Clear RTC Wake Up timer Flag
-    LL_RTC_WAKEUP_SetAutoReload(RTC, time);                // Configure the Wake-up Timer counter
-    LL_RTC_EnableIT_WUT(RTC);                              // Configure the Interrupt in the RTC_CR register
-    LL_RTC_WAKEUP_Enable(RTC);                             // Enable the Wake-up Timer
-    LL_RTC_EnableWriteProtection(RTC);                     // Enable write protection
+    RTC_WakeupProgram(time);
 }
 
 void DisableRTC_WakeupTimeout(void)
@@ -83,6 +185,95 @@ bool RTC_WakeupTimeout_Expired(void)
     return false;
 }
 
+int RTC_Scheduler_SetRateHz(uint32_t hz)
+{
+    if (hz == 0 || hz > RTC_WUT_CLOCK_HZ / RTC_SCHED_MIN_TICKS)
+        return -1;
+    sched_period_q16 = (uint32_t)(((uint64_t)RTC_WUT_CLOCK_HZ << 16) / hz);
+    return 0;
+}
+
+int RTC_Scheduler_SetPeriodUS(uint32_t us)
+{
+    uint64_t period_q16 = ((uint64_t)us * RTC_WUT_CLOCK_HZ << 16) / 1000000;
+
+    if (period_q16 < ((uint64_t)RTC_SCHED_MIN_TICKS << 16) || period_q16 > ((uint64_t)RTC_SCHED_MAX_TICKS << 16))
+        return -1;
+    sched_period_q16 = (uint32_t)period_q16;
+    return 0;
+}
+
+int RTC_Scheduler_Start(void)
+{
+    if (sched_period_q16 == 0)
+        return -1;
+    sched_running = false;
+    RTC_WU_Completed = false;
+    sched_next = RTC_GetTicks();
+    sched_frac = 0;
+    sched_running = true;
+    return RTC_Scheduler_Advance() == 0 ? 0 : -1;
+}
+
+void RTC_Scheduler_Stop(void)
+{
+    sched_running = false;
+    RTC_DisableAlarm();
+}
+
+uint32_t RTC_GetTicks(void)
+{
+    uint32_t tod, ticks;
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    tod = RTC_ReadTimeOfDay();
+    if (tod < rtc_last_tod)
+        rtc_day_base += RTC_DAY_TICKS; // midnight, calendar date is not used
+    rtc_last_tod = tod;
+    ticks = rtc_day_base + tod;
+    __set_PRIMASK(primask);
+    return ticks;
+}
+
+int RTC_SetAlarm(uint32_t deadline)
+{
+    int status;
+
+    RTC_ALARM_Completed = false;
+    status = RTC_AlarmProgram(deadline);
+    if (status != 0)
+    {
+        /* already due or not armed, expire now rather than after the calendar wraps or never */
+        alarm_timestamp = RTC_GetTicks();
+        RTC_ALARM_Completed = true;
+    }
+    return status;
+}
+
+void RTC_DisableAlarm(void)
+{
+    LL_RTC_DisableWriteProtection(RTC); // Disable write protection
+    LL_RTC_ALMA_Disable(RTC);           // Disable Alarm A
+    LL_RTC_DisableIT_ALRA(RTC);         //
+    LL_RTC_EnableWriteProtection(RTC);  // Enable write protection
+}
+
+bool RTC_Alarm_Expired(void)
+{
+    if (RTC_ALARM_Completed)
+    {
+        RTC_ALARM_Completed = false;
+        return true;
+    }
+    return false;
+}
+
+uint32_t RTC_Alarm_Timestamp(void)
+{
+    return alarm_timestamp;
+}
+
 void RTC_IRQHandler(void)
 {
     if (LL_RTC_IsActiveFlag_WUT(RTC))
@@ -90,4 +281,20 @@ void RTC_IRQHandler(void)
         RTC_WU_Completed = true;
         LL_RTC_ClearFlag_WUT(RTC);
     }
+    if (LL_RTC_IsActiveFlag_ALRA(RTC))
+    {
+        LL_RTC_ClearFlag_ALRA(RTC);
+        alarm_timestamp = alarm_deadline;
+        if (sched_running)
+        {
+            /* packet scheduler periods are signalled like a wakeup timeout */
+            RTC_Scheduler_Advance();
+            RTC_WU_Completed = true;
+        }
+        else
+        {
+            RTC_DisableAlarm();
+            RTC_ALARM_Completed = true;
+        }
+    }
 }
@@ -20,10 +20,32 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/* Wakeup timer clock, LSE / 2 */
+#define RTC_WUT_CLOCK_HZ 16384
+
+/* Free running timebase, the calendar subsecond counter at LSE / 2 (~61.035 us) */
+#define RTC_TICKS_PER_SEC       16384
+#define RTC_US_TO_TICKS(us)     ((uint32_t)(((uint64_t)(us) * RTC_TICKS_PER_SEC) / 1000000))
+#define RTC_TICKS_TO_US(ticks)  ((uint32_t)(((uint64_t)(ticks) * 1000000) / RTC_TICKS_PER_SEC))
+
+/* Alarms closer than this to the current tick may be missed by the compare */
+#define RTC_ALARM_MIN_LEAD      2
+
+/* ALRAWF polls before programming the alarm gives up, each at least one CPU clock: over four
+ * 32 kHz RTC clocks at 32 MHz, ALRAWF takes two */
+#define RTC_ALRAW_SPIN_MAX      4000
+
+/* Scheduler period limits, the period is kept in 16.16 ticks */
+#define RTC_SCHED_MIN_TICKS 2
+#define RTC_SCHED_MAX_TICKS 65535
 
 /**
  * @brief RTC init function
  *
+ * Also starts the free running timebase read by RTC_GetTicks() from 0.
+ *
  */
 void RTC_WakeupInit(void);
 
@@ -46,4 +68,86 @@ void DisableRTC_WakeupTimeout(void);
  */
 bool RTC_WakeupTimeout_Expired(void);
 
+/**
+ * @brief Current time on the free running RTC timebase
+ *
+ * Wraps after 2^32 ticks (~3 days), compare timestamps by subtraction.
+ * Must be called at least once a day, the alarm and scheduler do so.
+ *
+ * @return uint32_t ticks of 1 / RTC_TICKS_PER_SEC
+ */
+uint32_t RTC_GetTicks(void);
+
+/**
+ * @brief Schedule a one-shot alarm at an absolute time
+ *
+ * Only the alarm compare registers are written, the timebase keeps running.
+ * A deadline less than RTC_ALARM_MIN_LEAD ahead expires immediately. Not
+ * available while the packet scheduler runs, which uses the same alarm.
+ *
+ * @param deadline time in RTC_GetTicks() ticks, less than a day ahead
+ * @return int 0 if armed, -1 if already due, -2 if the alarm registers did not
+ *         unlock within RTC_ALRAW_SPIN_MAX polls. Expires immediately unless 0.
+ */
+int RTC_SetAlarm(uint32_t deadline);
+
+/**
+ * @brief Cancel a pending alarm
+ *
+ */
+void RTC_DisableAlarm(void);
+
+/**
+ * @brief Check if the alarm set by RTC_SetAlarm() is expired
+ *
+ */
+bool RTC_Alarm_Expired(void);
+
+/**
+ * @brief Time of the last alarm or scheduler event, in RTC_GetTicks() ticks
+ *
+ */
+uint32_t RTC_Alarm_Timestamp(void);
+
+/**
+ * @brief Set the packet scheduler rate
+ *
+ * The period is kept with a 16 bit fraction of a tick and each deadline is
+ * set as an absolute alarm on the timebase, so the long run rate is exact and
+ * time spent handling an event does not accumulate. May be called while the
+ * scheduler runs, the new rate applies from the next period.
+ *
+ * @param hz rate in Hz, 1 to RTC_TICKS_PER_SEC / RTC_SCHED_MIN_TICKS
+ * @return int 0 on success, -1 if out of range
+ */
+int RTC_Scheduler_SetRateHz(uint32_t hz);
+
+/**
+ * @brief Set the packet scheduler period
+ *
+ * Same as RTC_Scheduler_SetRateHz(), but as a period.
+ *
+ * @param us period in microseconds, about 123 us to 4 s
+ * @return int 0 on success, -1 if out of range
+ */
+int RTC_Scheduler_SetPeriodUS(uint32_t us);
+
+/**
+ * @brief Start the periodic wakeups at the configured rate
+ *
+ * Each period is signalled like a wakeup timeout, poll with
+ * RTC_WakeupTimeout_Expired() or wake from DEEPSTOP on the RTC. Periods
+ * missed while the CPU was busy are skipped, the grid is kept.
+ *
+ * @return int 0 on success, -1 if no rate or period was set or the alarm could
+ *         not be programmed
+ */
+int RTC_Scheduler_Start(void);
+
+/**
+ * @brief Stop the periodic wakeups and release the alarm
+ *
+ */
+void RTC_Scheduler_Stop(void);
+
 #endif /* INC_RTC_H_ */
@@ -15,10 +15,13 @@
  */
 
 #include "jv_spi_bsc.h"
+#include "jv_trace.h"
+#include "rf_driver_hal.h"
 #include "rf_driver_ll_bus.h"
 #include "rf_driver_ll_spi.h"
 #include "rf_driver_ll_dma.h"
 #include "rf_driver_ll_gpio.h"
+#include "rf_driver_ll_tim.h"
 
 
 void SPI_TransferError_Callback(void);
@@ -27,6 +30,21 @@ void DMA1_TransmitComplete_Callback(void);
 
 static volatile bool ubTransmissionComplete = false;
 
+/* Asynchronous TX queue, the descriptor at tx_queue_head is on air while tx_queue_count > 0 */
+typedef struct
+{
+    uint32_t tx_buffer;
+    uint16_t size;
+    SPI_DMA_Callback callback;
+} spi_dma_desc_t;
+
+static spi_dma_desc_t tx_queue[SPI_DMA_QUEUE_SIZE];
+static volatile uint8_t tx_queue_head = 0;
+static volatile uint8_t tx_queue_count = 0;
+
+/* SPI1->CR1 with SPE set, written by DMA channel 4 on the TIM17 update event */
+static uint32_t spi_cr1_enable;
+
 
 void SPI_DMA_Init(uint32_t tx_buffer, uint16_t size)
 {
@@ -66,7 +84,7 @@ void SPI_DMA_Init(uint32_t tx_buffer, uint16_t size)
     /* DMA configuration */
     LL_DMA_SetPeriphRequest(DMA1, LL_DMA_CHANNEL_3, LL_DMAMUX_REQ_SPI1_TX);
     LL_DMA_SetDataTransferDirection(DMA1, LL_DMA_CHANNEL_3, LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
-    LL_DMA_SetChannelPriorityLevel(DMA1, LL_DMA_CHANNEL_3, LL_DMA_PRIORITY_LOW);
+    LL_DMA_SetChannelPriorityLevel(DMA1, LL_DMA_CHANNEL_3, LL_DMA_PRIORITY_VERYHIGH); // no underrun on air, above the IMU channels 1/2
     LL_DMA_SetMode(DMA1, LL_DMA_CHANNEL_3, LL_DMA_MODE_NORMAL);
     LL_DMA_SetPeriphIncMode(DMA1, LL_DMA_CHANNEL_3, LL_DMA_PERIPH_NOINCREMENT);
     LL_DMA_SetMemoryIncMode(DMA1, LL_DMA_CHANNEL_3, LL_DMA_MEMORY_INCREMENT);
@@ -95,18 +113,116 @@ void SPI_DMA_Uninit(void)
 {
     LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_3);
     LL_APB1_DisableClock(LL_APB1_PERIPH_SPI1);
-    LL_AHB_DisableClock(LL_AHB_PERIPH_DMA);
+    /* channels 1/2 may still be reading the IMU */
+    if (!LL_DMA_IsEnabledChannel(DMA1, LL_DMA_CHANNEL_1) && !LL_DMA_IsEnabledChannel(DMA1, LL_DMA_CHANNEL_2))
+        LL_AHB_DisableClock(LL_AHB_PERIPH_DMA);
 }
 
 void SPI_DMA_Activate(void)
 {
 	ubTransmissionComplete = false;
+    JV_TRACE_BEGIN(JV_TRACE_DMA_COMPLETE);
     /* Enable SPI */
     LL_SPI_Enable(SPI1);
     /* Enable DMA Channels Tx */
     LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_3);
 }
 
+void SPI_DMA_Retrigger(uint16_t size)
+{
+	ubTransmissionComplete = false;
+    JV_TRACE_BEGIN(JV_TRACE_DMA_COMPLETE);
+    /* Channel keeps its addresses and clocks, only the transfer count is reloaded */
+    LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_3);
+    LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_3, size);
+    LL_SPI_Enable(SPI1);
+    LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_3);
+}
+
+void SPI_DMA_TimedInit(void)
+{
+    LL_APB0_EnableClock(LL_APB0_PERIPH_TIM17);
+    LL_AHB_EnableClock(LL_AHB_PERIPH_DMA);
+
+    /* TIM17: one-shot up counter, only the overflow raises the update DMA request */
+    LL_TIM_SetPrescaler(TIM17, (HAL_TIM_GetPeriphClock(TIM17) / SPI_DMA_TIMED_HZ) - 1);
+    LL_TIM_SetCounterMode(TIM17, LL_TIM_COUNTERMODE_UP);
+    LL_TIM_DisableARRPreload(TIM17);
+    LL_TIM_SetOnePulseMode(TIM17, LL_TIM_ONEPULSEMODE_SINGLE);
+    LL_TIM_SetUpdateSource(TIM17, LL_TIM_UPDATESOURCE_COUNTER);
+    LL_TIM_GenerateEvent_UPDATE(TIM17); // load the prescaler
+    LL_TIM_ClearFlag_UPDATE(TIM17);
+
+    /* DMA channel 4: one word to SPI1->CR1 per TIM17 update */
+    LL_DMA_SetPeriphRequest(DMA1, LL_DMA_CHANNEL_4, LL_DMAMUX_REQ_TIM17_UP);
+    LL_DMA_SetDataTransferDirection(DMA1, LL_DMA_CHANNEL_4, LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+    LL_DMA_SetChannelPriorityLevel(DMA1, LL_DMA_CHANNEL_4, LL_DMA_PRIORITY_HIGH);
+    LL_DMA_SetMode(DMA1, LL_DMA_CHANNEL_4, LL_DMA_MODE_NORMAL);
+    LL_DMA_SetPeriphIncMode(DMA1, LL_DMA_CHANNEL_4, LL_DMA_PERIPH_NOINCREMENT);
+    LL_DMA_SetMemoryIncMode(DMA1, LL_DMA_CHANNEL_4, LL_DMA_MEMORY_NOINCREMENT);
+    LL_DMA_SetPeriphSize(DMA1, LL_DMA_CHANNEL_4, LL_DMA_PDATAALIGN_WORD);
+    LL_DMA_SetMemorySize(DMA1, LL_DMA_CHANNEL_4, LL_DMA_MDATAALIGN_WORD);
+    LL_DMA_ConfigAddresses(DMA1, LL_DMA_CHANNEL_4, (uint32_t)&spi_cr1_enable, (uint32_t)&SPI1->CR1, LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+}
+
+void SPI_DMA_ActivateIn(uint32_t ticks)
+{
+	ubTransmissionComplete = false;
+    JV_TRACE_BEGIN(JV_TRACE_DMA_COMPLETE);
+    /* SPI stays disabled, the TX channel only fills the FIFO until SPE is set */
+    LL_SPI_Disable(SPI1);
+    spi_cr1_enable = SPI1->CR1 | SPI_CR1_SPE;
+    LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_3);
+
+    /* arm the CR1 write and start the one-shot timer */
+    LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_4);
+    LL_DMA_ClearFlag_GI4(DMA1);
+    LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_4, 1);
+    LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_4);
+    LL_TIM_DisableCounter(TIM17);
+    LL_TIM_SetCounter(TIM17, 0);
+    LL_TIM_SetAutoReload(TIM17, ticks - 1);
+    LL_TIM_ClearFlag_UPDATE(TIM17);
+    LL_TIM_EnableDMAReq_UPDATE(TIM17);
+    LL_TIM_EnableCounter(TIM17);
+}
+
+static void SPI_DMA_Start(const spi_dma_desc_t *desc)
+{
+	ubTransmissionComplete = false;
+    JV_TRACE_BEGIN(JV_TRACE_DMA_COMPLETE);
+    LL_DMA_DisableChannel(DMA1, LL_DMA_CHANNEL_3);
+    LL_DMA_SetMemoryAddress(DMA1, LL_DMA_CHANNEL_3, desc->tx_buffer);
+    LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_3, desc->size);
+    LL_SPI_Enable(SPI1);
+    LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_3);
+}
+
+int SPI_DMA_Submit(uint32_t tx_buffer, uint16_t size, SPI_DMA_Callback callback)
+{
+    __disable_irq();
+    if (tx_queue_count >= SPI_DMA_QUEUE_SIZE)
+    {
+        __enable_irq();
+        return -1;
+    }
+    spi_dma_desc_t *desc = &tx_queue[(tx_queue_head + tx_queue_count) % SPI_DMA_QUEUE_SIZE];
+    desc->tx_buffer = tx_buffer;
+    desc->size = size;
+    desc->callback = callback;
+    if (tx_queue_count++ == 0)
+    {
+        SPI_DMA_Start(desc);
+    }
+    __enable_irq();
+    return 0;
+}
+
+uint8_t SPI_DMA_Pending(void)
+{
+    return tx_queue_count;
+}
+
 bool DMA_SPI_TransmitCompleted(void)
 {
 	if (ubTransmissionComplete)
@@ -124,6 +240,11 @@ void SPI_TransferError_Callback(void)
         ;
 }
 
+/* Other users of the shared DMA interrupt override this */
+__attribute__((weak)) void DMA_Shared_IRQHandler(void)
+{
+}
+
 void DMA_IRQHandler(void)
 {
     if (LL_DMA_IsActiveFlag_TC3(DMA1))
@@ -138,20 +259,28 @@ void DMA_IRQHandler(void)
         SPI_TransferError_Callback();
     }
 
-    if (LL_DMA_IsActiveFlag_TC1(DMA1))
-    {
-        LL_DMA_ClearFlag_GI1(DMA1);
-        /* Call function Reception complete Callback */
-    }
-    else if (LL_DMA_IsActiveFlag_TE1(DMA1))
-    {
-        /* Call Error function */
-        SPI_TransferError_Callback();
-    }
+    /* channels 1/2, IMU reads */
+    DMA_Shared_IRQHandler();
 }
 
 void DMA1_TransmitComplete_Callback(void)
 {
     /* DMA Tx transfer completed */
+    JV_TRACE_END(JV_TRACE_DMA_COMPLETE);
     ubTransmissionComplete = true;
+
+    /* Retire the queued descriptor and start the next one before calling back */
+    if (tx_queue_count)
+    {
+        spi_dma_desc_t done = tx_queue[tx_queue_head];
+        tx_queue_head = (tx_queue_head + 1) % SPI_DMA_QUEUE_SIZE;
+        if (--tx_queue_count)
+        {
+            SPI_DMA_Start(&tx_queue[tx_queue_head]);
+        }
+        if (done.callback)
+        {
+            done.callback(done.tx_buffer);
+        }
+    }
 }
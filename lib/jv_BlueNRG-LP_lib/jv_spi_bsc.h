@@ -21,6 +21,20 @@
 #include <stdbool.h>
 #include <main.h>
 
+#ifndef SPI_DMA_QUEUE_SIZE
+#define SPI_DMA_QUEUE_SIZE 4
+#endif
+
+/* TIM17 tick rate used by SPI_DMA_ActivateIn(), 0.25 us resolution and ~16 ms range */
+#define SPI_DMA_TIMED_HZ           4000000
+#define SPI_DMA_TIMED_TICKS_PER_US (SPI_DMA_TIMED_HZ / 1000000)
+
+/**
+ * @brief Completion callback for SPI_DMA_Submit(), called from DMA_IRQHandler
+ *
+ * @param tx_buffer buffer that finished transmitting, as passed to SPI_DMA_Submit()
+ */
+typedef void (*SPI_DMA_Callback)(uint32_t tx_buffer);
 
 /**
  * @brief SPI + DMA init function
@@ -50,10 +64,71 @@ void SPI_DMA_Uninit(void);
  */
 void SPI_DMA_Activate(void);
 
+/**
+ * @brief Restart transfer on SPI without reconfiguring SPI + DMA
+ *
+ * Fast path for a channel that stays armed between packets: the SPI1/DMA clocks
+ * stay on and the buffer address set by SPI_DMA_Init() is kept, so only the
+ * transfer count is reloaded. Do not call SPI_DMA_Uninit() between transfers.
+ *
+ * @param size size of buffer to transmit
+ */
+void SPI_DMA_Retrigger(uint16_t size);
+
+/**
+ * @brief Configure TIM17 and DMA channel 4 for hardware timed transfer start
+ *
+ * Call once after SPI_DMA_Init(). The configuration survives SPI_DMA_Uninit().
+ *
+ */
+void SPI_DMA_TimedInit(void);
+
+/**
+ * @brief Start transfer on SPI a fixed number of timer ticks from now
+ *
+ * Replaces SPI_DMA_Activate(). The TX channel is enabled right away with the SPI
+ * disabled, so it only preloads the SPI FIFO. A one-shot TIM17 update then
+ * triggers DMA channel 4, which sets SPE in SPI1->CR1, so the first bit leaves
+ * at the programmed tick regardless of interrupt latency.
+ *
+ * @param ticks delay in SPI_DMA_TIMED_HZ ticks, 1 to 65536
+ */
+void SPI_DMA_ActivateIn(uint32_t ticks);
+
+/**
+ * @brief Queue a buffer for transmission without waiting for it
+ *
+ * Starts right away if the SPI is idle, otherwise from DMA_IRQHandler when the
+ * previous buffer completes. Requires SPI_DMA_Init() first. The buffer must not
+ * be modified until its callback runs or SPI_DMA_Pending() drops below its
+ * position. Do not mix with SPI_DMA_Activate()/SPI_DMA_Uninit() while pending.
+ *
+ * @param tx_buffer location of buffer to transmit, casted to uint32_t
+ * @param size size of buffer to transmit
+ * @param callback called once the buffer has been transmitted, or NULL
+ * @return int 0 if queued, -1 if the queue is full
+ */
+int SPI_DMA_Submit(uint32_t tx_buffer, uint16_t size, SPI_DMA_Callback callback);
+
+/**
+ * @brief Number of submitted buffers not yet completed, including the one on air
+ *
+ */
+uint8_t SPI_DMA_Pending(void);
+
 /**
  * @brief Check if SPI transfer is completed
  *
  */
 bool DMA_SPI_TransmitCompleted(void);
 
+/**
+ * @brief Hook for the other channels of the shared DMA interrupt
+ *
+ * Called from DMA_IRQHandler after channel 3 is handled. Weak and empty here,
+ * jv_imu.c overrides it for the channel 1/2 IMU reads.
+ *
+ */
+void DMA_Shared_IRQHandler(void);
+
 #endif /* INC_SPI_DMA_H_ */
@@ -0,0 +1,122 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_timer.c
+ * @brief Software timers multiplexed on the RTC alarm
+ * @date 2023-03-20
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ */
+
+#include <stddef.h>
+#include "jv_timer.h"
+
+static jv_timer_t *timer_head = NULL;
+
+static void jv_timer_Unlink(jv_timer_t *timer)
+{
+    jv_timer_t **link = &timer_head;
+
+    while (*link && *link != timer)
+        link = &(*link)->next;
+    if (*link)
+        *link = timer->next;
+    timer->active = false;
+}
+
+/* Insert after any timer with the same deadline, so equal deadlines run in start order */
+static void jv_timer_Insert(jv_timer_t *timer)
+{
+    jv_timer_t **link = &timer_head;
+
+    while (*link && (int32_t)((*link)->deadline - timer->deadline) <= 0)
+        link = &(*link)->next;
+    timer->next = *link;
+    *link = timer;
+    timer->active = true;
+}
+
+static void jv_timer_Reload(jv_timer_t *timer)
+{
+    uint32_t frac = (uint32_t)timer->frac + (timer->period_q16 & 0xFFFF);
+
+    timer->deadline += (timer->period_q16 >> 16) + (frac >> 16);
+    timer->frac = (uint16_t)frac;
+}
+
+void jv_timer_Start(jv_timer_t *timer, uint32_t deadline, uint32_t period_q16, jv_timer_cb callback, void *arg)
+{
+    if (timer->active)
+        jv_timer_Unlink(timer);
+    timer->deadline = deadline;
+    timer->period_q16 = period_q16;
+    timer->frac = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+    jv_timer_Insert(timer);
+}
+
+void jv_timer_Stop(jv_timer_t *timer)
+{
+    if (timer->active)
+        jv_timer_Unlink(timer);
+}
+
+void jv_timer_SetPeriod(jv_timer_t *timer, uint32_t period_q16)
+{
+    timer->period_q16 = period_q16;
+}
+
+uint32_t jv_timer_Deadline(const jv_timer_t *timer)
+{
+    return timer->deadline;
+}
+
+void jv_timer_Dispatch(void)
+{
+    jv_timer_t *timer;
+    uint32_t now;
+
+    do
+    {
+        now = RTC_GetTicks();
+        while ((timer = timer_head) != NULL && (int32_t)(timer->deadline - now) <= JV_TIMER_BATCH_TICKS)
+        {
+            timer_head = timer->next;
+            timer->active = false;
+            if (timer->period_q16)
+            {
+                /* keep the grid, skip periods missed while busy */
+                do
+                {
+                    jv_timer_Reload(timer);
+                } while ((int32_t)(timer->deadline - now) <= 0);
+                jv_timer_Insert(timer);
+            }
+            timer->callback(timer->arg);
+            now = RTC_GetTicks();
+        }
+        if (timer_head == NULL)
+        {
+            RTC_DisableAlarm();
+            return;
+        }
+        /* an alarm that is already due is not armed, run it now instead; with the alarm
+         * registers locked (-2) this polls the deadline until they unlock */
+    } while (RTC_SetAlarm(timer_head->deadline) != 0);
+}
+
+uint32_t jv_timer_TicksToNext(void)
+{
+    int32_t ticks;
+
+    if (timer_head == NULL)
+        return UINT32_MAX;
+    ticks = (int32_t)(timer_head->deadline - RTC_GetTicks());
+    return ticks > 0 ? (uint32_t)ticks : 0;
+}
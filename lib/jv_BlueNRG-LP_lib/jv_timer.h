@@ -0,0 +1,104 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_timer.h
+ * @brief Software timers multiplexed on the RTC alarm
+ * @date 2023-03-20
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Timers are kept in a list sorted by deadline, on the RTC_GetTicks() timebase,
+ * and the RTC alarm is always set to the earliest one. Callbacks run from
+ * jv_timer_Dispatch() in the main loop, never from an interrupt, so they may do
+ * SPI transfers or start other timers. Timers due within JV_TIMER_BATCH_TICKS of
+ * each other run in the same wake. The packet scheduler in jv_rtc uses the same
+ * alarm, use one or the other.
+ *
+ */
+
+#ifndef INC_JV_TIMER_H_
+#define INC_JV_TIMER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "jv_rtc.h"
+
+#ifndef JV_TIMER_BATCH_TICKS
+#define JV_TIMER_BATCH_TICKS RTC_ALARM_MIN_LEAD
+#endif
+
+/* Periods are 16.16 RTC ticks so any rate keeps an exact long run average */
+#define JV_TIMER_PERIOD_HZ(hz) ((uint32_t)(((uint64_t)RTC_TICKS_PER_SEC << 16) / (hz)))
+#define JV_TIMER_PERIOD_US(us) ((uint32_t)(((uint64_t)(us) * RTC_TICKS_PER_SEC << 16) / 1000000))
+
+typedef void (*jv_timer_cb)(void *arg);
+
+typedef struct jv_timer
+{
+    struct jv_timer *next;
+    uint32_t deadline;   // RTC ticks
+    uint32_t period_q16; // 0 for one-shot
+    uint16_t frac;       // fraction of a tick carried to the next deadline
+    bool active;
+    jv_timer_cb callback;
+    void *arg;
+} jv_timer_t;
+
+/**
+ * @brief Start or restart a timer
+ *
+ * @param timer timer to start, must stay valid while active
+ * @param deadline first expiry, absolute in RTC_GetTicks() ticks
+ * @param period_q16 reload period from JV_TIMER_PERIOD_HZ()/JV_TIMER_PERIOD_US(), 0 for one-shot
+ * @param callback called from jv_timer_Dispatch()
+ * @param arg passed to callback
+ */
+void jv_timer_Start(jv_timer_t *timer, uint32_t deadline, uint32_t period_q16, jv_timer_cb callback, void *arg);
+
+/**
+ * @brief Stop a timer, no-op if it is not active
+ *
+ * @param timer timer to stop
+ */
+void jv_timer_Stop(jv_timer_t *timer);
+
+/**
+ * @brief Change the period of a periodic timer, applies after its next expiry
+ *
+ * @param timer timer to change
+ * @param period_q16 new period, 0 to make it one-shot
+ */
+void jv_timer_SetPeriod(jv_timer_t *timer, uint32_t period_q16);
+
+/**
+ * @brief Next expiry of a timer
+ *
+ * Inside its own callback this is already the following deadline.
+ *
+ * @param timer timer to query
+ * @return uint32_t deadline in RTC ticks
+ */
+uint32_t jv_timer_Deadline(const jv_timer_t *timer);
+
+/**
+ * @brief Run all due timers and set the RTC alarm to the earliest remaining one
+ *
+ * Call from the main loop after every wake. On return the alarm is armed at
+ * least RTC_ALARM_MIN_LEAD ahead, or disabled if no timer is active, so the
+ * caller can sleep until RTC_Alarm_Expired().
+ *
+ */
+void jv_timer_Dispatch(void);
+
+/**
+ * @brief Ticks until the earliest timer, to choose between WFE and DEEPSTOP
+ *
+ * @return uint32_t ticks, UINT32_MAX if no timer is active
+ */
+uint32_t jv_timer_TicksToNext(void);
+
+#endif /* INC_JV_TIMER_H_ */
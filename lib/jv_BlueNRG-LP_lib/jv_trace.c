@@ -0,0 +1,132 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_trace.c
+ * @brief Per-stage cycle count tracing for the endpoint wake cycle
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ */
+
+#include "jv_trace.h"
+
+#ifdef JV_TRACE
+
+#include "rf_driver_hal.h"
+
+#define JV_TRACE_MAGIC      0x4A565452 // "JVTR"
+#define JV_TRACE_RING_MAX   0x00FFFFFF // ring samples saturate at 24 bit
+
+typedef struct
+{
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t count;
+} jv_trace_acc_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t head;                          // next ring slot to write
+    uint32_t ring[JV_TRACE_RING_SIZE];      // stage << 24 | min(cycles, JV_TRACE_RING_MAX)
+    jv_trace_acc_t acc[JV_TRACE_STAGE_COUNT];
+} jv_trace_buffer_t;
+
+jv_trace_buffer_t jv_trace_buffer __attribute__((section(".noinit")));
+
+static uint32_t stage_start[JV_TRACE_STAGE_COUNT];
+static uint32_t stage_open; // bit per stage between Begin and End
+
+/* HAL tick count extended with the cycles already spent in the current tick */
+static inline uint32_t jv_trace_Now(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint32_t reload, ticks, val;
+
+    __disable_irq();
+    reload = SysTick->LOAD + 1;
+    ticks = HAL_GetTick();
+    val = SysTick->VAL; // counts down
+    /* reloaded, but the tick interrupt has not run yet */
+    if ((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && val > reload / 2)
+        ticks++;
+    __set_PRIMASK(primask);
+    return ticks * reload + (reload - 1 - val);
+}
+
+void jv_trace_Init(void)
+{
+    /* SysTick is not retained in DEEPSTOP, bring the HAL tick back */
+    if (!(SysTick->CTRL & SysTick_CTRL_ENABLE_Msk))
+        HAL_InitTick(TICK_INT_PRIORITY);
+
+    if (jv_trace_buffer.magic != JV_TRACE_MAGIC)
+        jv_trace_Reset();
+}
+
+void jv_trace_Reset(void)
+{
+    jv_trace_buffer.head = 0;
+    for (uint32_t i = 0; i < JV_TRACE_RING_SIZE; i++)
+        jv_trace_buffer.ring[i] = 0;
+    for (uint32_t i = 0; i < JV_TRACE_STAGE_COUNT; i++)
+    {
+        jv_trace_buffer.acc[i].min = UINT32_MAX;
+        jv_trace_buffer.acc[i].max = 0;
+        jv_trace_buffer.acc[i].sum = 0;
+        jv_trace_buffer.acc[i].count = 0;
+    }
+    jv_trace_buffer.magic = JV_TRACE_MAGIC;
+}
+
+void jv_trace_Begin(jv_trace_stage_t stage)
+{
+    __disable_irq();
+    stage_start[stage] = jv_trace_Now();
+    stage_open |= (1UL << stage);
+    __enable_irq();
+}
+
+void jv_trace_End(jv_trace_stage_t stage)
+{
+    uint32_t cycles = jv_trace_Now() - stage_start[stage];
+    jv_trace_acc_t *acc = &jv_trace_buffer.acc[stage];
+
+    __disable_irq(); // DMA complete is recorded from the DMA interrupt
+    if (!(stage_open & (1UL << stage)))
+    {
+        __enable_irq(); // End without a matching Begin, e.g. the first loop iteration
+        return;
+    }
+    stage_open &= ~(1UL << stage);
+    jv_trace_buffer.ring[jv_trace_buffer.head] =
+        ((uint32_t)stage << 24) | (cycles < JV_TRACE_RING_MAX ? cycles : JV_TRACE_RING_MAX);
+    jv_trace_buffer.head = (jv_trace_buffer.head + 1) & (JV_TRACE_RING_SIZE - 1);
+    if (cycles < acc->min)
+        acc->min = cycles;
+    if (cycles > acc->max)
+        acc->max = cycles;
+    acc->sum += cycles;
+    acc->count++;
+    __enable_irq();
+}
+
+void jv_trace_GetStats(jv_trace_stage_t stage, jv_trace_stats_t *stats)
+{
+    const jv_trace_acc_t *acc = &jv_trace_buffer.acc[stage];
+
+    __disable_irq();
+    stats->count = acc->count;
+    stats->min = acc->count ? acc->min : 0;
+    stats->max = acc->max;
+    stats->avg = acc->count ? (uint32_t)(acc->sum / acc->count) : 0;
+    __enable_irq();
+}
+
+#endif /* JV_TRACE */
@@ -0,0 +1,110 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_trace.h
+ * @brief Per-stage cycle count tracing for the endpoint wake cycle
+ * @date 2023-03-08
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Enable by defining JV_TRACE in main.h. Otherwise every marker compiles to nothing.
+ *
+ * Stages are timed in core clock cycles read from the HAL tick: the 1 ms tick
+ * count times the SysTick reload plus the current SysTick count. SysTick keeps
+ * its HAL configuration, so HAL_GetTick() and the SysTick_IRQHandler keep
+ * running. A stage can last up to 2^32 cycles (~134 s at 32 MHz), ring samples
+ * saturate at 24 bit (~0.5 s). Assumes the default 1 kHz HAL tick. Raw
+ * samples go to a ring buffer and per-stage min/max/sum/count to a stats
+ * table, both in .noinit RAM so they can be read with the debugger, even
+ * after a reset.
+ *
+ */
+
+#ifndef INC_JV_TRACE_H_
+#define INC_JV_TRACE_H_
+
+#include <stdint.h>
+#include <main.h>
+
+#ifndef JV_TRACE_RING_SIZE
+#define JV_TRACE_RING_SIZE 256 // must be a power of 2
+#endif
+
+typedef enum
+{
+    JV_TRACE_PDU_BUILD,
+    JV_TRACE_CRC_WHITEN,
+    JV_TRACE_FEC,
+    JV_TRACE_UPSCALE,
+    JV_TRACE_DMA_START,
+    JV_TRACE_DMA_COMPLETE,
+    JV_TRACE_IMU_READ,
+    JV_TRACE_RTC_WAIT,
+    JV_TRACE_WAKE_TO_TX, // end of RTC wait until the DMA channel is enabled
+    JV_TRACE_WAKE_TO_RX, // DEEPSTOP peripheral restore until the downlink RX is started
+    JV_TRACE_STAGE_COUNT
+} jv_trace_stage_t;
+
+typedef struct
+{
+    uint32_t min;
+    uint32_t avg;
+    uint32_t max;
+    uint32_t count;
+} jv_trace_stats_t;
+
+#ifdef JV_TRACE
+
+/**
+ * @brief Restart the HAL tick if DEEPSTOP stopped it and validate the .noinit buffers
+ *
+ */
+void jv_trace_Init(void);
+
+/**
+ * @brief Clear the ring buffer and the per-stage statistics
+ *
+ */
+void jv_trace_Reset(void);
+
+/**
+ * @brief Mark the start of a stage
+ *
+ * @param stage Stage to start
+ */
+void jv_trace_Begin(jv_trace_stage_t stage);
+
+/**
+ * @brief Mark the end of a stage and record the elapsed cycles
+ *
+ * Ignored if the stage was not started with jv_trace_Begin().
+ *
+ * @param stage Stage to end
+ */
+void jv_trace_End(jv_trace_stage_t stage);
+
+/**
+ * @brief Get min/avg/max cycle counts of a stage
+ *
+ * @param stage Stage to export
+ * @param stats Destination for the statistics
+ */
+void jv_trace_GetStats(jv_trace_stage_t stage, jv_trace_stats_t *stats);
+
+#define JV_TRACE_INIT()       jv_trace_Init()
+#define JV_TRACE_BEGIN(stage) jv_trace_Begin(stage)
+#define JV_TRACE_END(stage)   jv_trace_End(stage)
+
+#else
+
+#define JV_TRACE_INIT()       ((void)0)
+#define JV_TRACE_BEGIN(stage) ((void)0)
+#define JV_TRACE_END(stage)   ((void)0)
+
+#endif /* JV_TRACE */
+
+#endif /* INC_JV_TRACE_H_ */
@@ -14,7 +14,14 @@
  *
  */
 
+#include <string.h>
 #include "jv_imu.h"
+#include "rf_driver_ll_bus.h"
+#include "rf_driver_ll_dma.h"
+#include "rf_driver_ll_gpio.h"
+#include "rf_driver_ll_spi.h"
+#include "../jv_BlueNRG-LP_lib/jv_spi_bsc.h"
+#include "../jv_BlueNRG-LP_lib/jv_delayUS.h"
 
 /* IMU SPI defines */
 #define IMU_SPI_MASTER SPI2
@@ -34,6 +41,24 @@
 #define __HAL_RCC_SPI_MASTER_FORCE_RESET() __HAL_RCC_SPI2_FORCE_RESET()
 #define __HAL_RCC_SPI_MASTER_RELEASE_RESET() __HAL_RCC_SPI2_RELEASE_RESET()
 #define __HAL_RCC_SPI_MASTER_CLK_DISABLE __HAL_RCC_SPI2_CLK_DISABLE
+#ifndef IMU_SPI_KERNEL_HZ
+#define IMU_SPI_KERNEL_HZ 32000000 // SPI2 kernel clock
+#endif
+#define IMU_SPI_MAX_HZ 10000000    // LSM6DSO32 SPI clock limit
+#if IMU_SPI_KERNEL_HZ / 2 <= IMU_SPI_MAX_HZ
+#define IMU_SPI_PRESCALER SPI_BAUDRATEPRESCALER_2
+#define IMU_SPI_DIV       2
+#elif IMU_SPI_KERNEL_HZ / 4 <= IMU_SPI_MAX_HZ
+#define IMU_SPI_PRESCALER SPI_BAUDRATEPRESCALER_4
+#define IMU_SPI_DIV       4
+#elif IMU_SPI_KERNEL_HZ / 8 <= IMU_SPI_MAX_HZ
+#define IMU_SPI_PRESCALER SPI_BAUDRATEPRESCALER_8
+#define IMU_SPI_DIV       8
+#else
+#define IMU_SPI_PRESCALER SPI_BAUDRATEPRESCALER_16
+#define IMU_SPI_DIV       16
+#endif
+#define IMU_SPI_SPIN_MAX  (4 * 8 * IMU_SPI_DIV) // flag polls per byte, each at least one CPU clock: 4 byte times
 #define IMU_SPI_MASTER_IRQn SPI2_IRQn
 #define IMU_SPI_MASTER_IRQHandler SPI2_IRQHandler
 #define IMU_INT1_PIN GPIO_PIN_3
@@ -45,10 +70,52 @@
 #define IMU_INT_EXTI_IRQn GPIOB_IRQn
 #define IMU_INT_IRQHANDLER GPIOA_IRQHandler
 
+#define IMU_DMA_RX_CHANNEL LL_DMA_CHANNEL_1
+#define IMU_DMA_TX_CHANNEL LL_DMA_CHANNEL_2
+#define IMU_DMA_STATUS_LEN 2  // address + STATUS_REG
+#define IMU_DMA_BURST_LEN  15 // address + OUT_TEMP_L .. OUTZ_H_A
+#define IMU_DMA_TS_LEN     5  // address + TIMESTAMP0 .. TIMESTAMP3
+
+#define IMU_POLL_US            50    // between status reads while waiting for the IMU
+#define IMU_TURN_ON_TIMEOUT_US 20000 // power-up and memory boot, 10 ms max in the datasheet
+#define IMU_RESET_TIMEOUT_US   1000  // software reset, 50 us typical
+#define IMU_I3C_RETRIES        3
+
 EXTI_HandleTypeDef HEXTI_InitStructure;
 
 extern volatile uint8_t data_ready;
 
+/* async read state, owned by the DMA interrupt while a read is running */
+typedef enum
+{
+    IMU_DMA_IDLE,
+    IMU_DMA_STATUS,
+    IMU_DMA_WAIT, // no new sample yet, the next DRDY pulse reads the status again
+    IMU_DMA_BURST,
+    IMU_DMA_TIMESTAMP,
+} imu_dma_state_t;
+
+static volatile imu_dma_state_t imu_dma_state = IMU_DMA_IDLE;
+static volatile int32_t imu_dma_result = 0;
+static uint16_t *imu_dma_buf;
+static __attribute((aligned(4))) uint8_t imu_dma_tx[IMU_DMA_BURST_LEN];
+static __attribute((aligned(4))) uint8_t imu_dma_rx[IMU_DMA_BURST_LEN];
+
+/* DRDY latch, the DMA fills one half while the other holds the newest sample */
+static uint16_t imu_latch[2][9];
+static uint8_t imu_latch_write = 0;
+static volatile uint8_t imu_latch_ready = 0xFF; // none yet
+
+static void imu_latch_sample(void);
+static void imu_dma_transfer(uint8_t reg, uint16_t len);
+
+static bool imu_gy_sleeps = false; // imu_activity_init() powers the gyro down while inactive
+
+#ifdef IMU_LOW_LATENCY
+static volatile uint32_t imu_drdy_us;
+static volatile bool imu_drdy_seen = false;
+#endif
+
 void imu_interrupt_init(void)
 {
     GPIO_InitTypeDef GPIO_InitStructure = {0};
@@ -93,14 +160,51 @@ void imu_interrupt_disable(void)
 
 void imu_EXTI_callback(uint32_t Line)
 {
-	(void)Line;
+    (void)Line;
     data_ready = 1;
+#ifdef IMU_LOW_LATENCY
+    imu_drdy_us = jv_timeUS(); // dates the sample of this pulse
+    imu_drdy_seen = true;
+#endif
+    if (imu_dma_state == IMU_DMA_WAIT)
+    {
+        /* retry a DMA read that found no new sample, one status read per pulse */
+        imu_dma_state = IMU_DMA_STATUS;
+        imu_dma_transfer(LSM6DSO32_STATUS_REG, IMU_DMA_STATUS_LEN);
+#ifdef IMU_DMA_READ
+        imu_interrupt_disable();
+#endif
+        return;
+    }
+#ifdef IMU_DRDY
+    imu_latch_sample();
+#endif
+}
+
+typedef int32_t (*imu_flag_get_t)(stmdev_ctx_t *dev_ctx, uint8_t *val);
+
+/* poll a status getter until it reads done, timed on jv_delayUS so the bound does not depend on the CPU clock */
+static int32_t imu_wait_flag(stmdev_ctx_t *dev_ctx, imu_flag_get_t get, uint8_t done, uint32_t timeout_us)
+{
+    uint8_t val;
+
+    for (uint32_t waited = 0;; waited += IMU_POLL_US)
+    {
+        if (get(dev_ctx, &val) == 0 && val == done)
+            return 0;
+        if (waited >= timeout_us)
+            return -1;
+        jv_delayUS(IMU_POLL_US);
+    }
 }
 
-static void test_delay(void)
+static int32_t imu_whoami_ok(stmdev_ctx_t *dev_ctx, uint8_t *ok)
 {
-    for (volatile uint32_t i = 0; i < 100000; i++)
-        ;
+    uint8_t whoamI = 0;
+    int32_t result = lsm6dso32_device_id_get(dev_ctx, &whoamI);
+
+    *ok = (whoamI == LSM6DSO32_ID);
+    return result;
 }
 
 void GPIOB_IRQHandler(void)
@@ -111,37 +215,55 @@ void GPIOB_IRQHandler(void)
 int32_t imu_init(stmdev_ctx_t *dev_ctx)
 {
     int32_t result = 0;
-    uint8_t whoamI = 0;
     lsm6dso32_i3c_disable_t i3c_disable = 0;
     lsm6dso32_pin_int1_route_t int1_ctrl = {0};
     lsm6dso32_pin_int2_route_t int2_ctrl = {0};
 
-    do
-    {
-        result |= lsm6dso32_device_id_get(dev_ctx, &whoamI);                 // get device id
-    } while (whoamI != LSM6DSO32_ID);                                        // until valid device id
-    lsm6dso32_boot_set(dev_ctx, PROPERTY_ENABLE);                            // Reboot
-    test_delay();                                                            // Wait a bit
+    if (imu_wait_flag(dev_ctx, imu_whoami_ok, 1, IMU_TURN_ON_TIMEOUT_US) != 0) // until valid device id
+        return -1;                                                           // no IMU on the bus
+    result |= lsm6dso32_boot_set(dev_ctx, PROPERTY_ENABLE);                  // Reboot
+    if (imu_wait_flag(dev_ctx, lsm6dso32_boot_get, 0, IMU_TURN_ON_TIMEOUT_US) != 0) // BOOT clears when done
+        return -1;                                                           //
     result |= lsm6dso32_reset_set(dev_ctx, PROPERTY_ENABLE);                 // Restore default configuration
-    test_delay();                                                            // Wait a bit
-    do                                                                       //
+    if (imu_wait_flag(dev_ctx, lsm6dso32_reset_get, 0, IMU_RESET_TIMEOUT_US) != 0) // SW_RESET clears when done
+        return -1;                                                           //
+    for (uint8_t i = 0; i < IMU_I3C_RETRIES && i3c_disable != LSM6DSO32_I3C_DISABLE; i++)
     {                                                                        //
         result |= lsm6dso32_i3c_disable_set(dev_ctx, LSM6DSO32_I3C_DISABLE); // Disable I3C interface
         result |= lsm6dso32_i3c_disable_get(dev_ctx, &i3c_disable);          //
-    } while (i3c_disable != LSM6DSO32_I3C_DISABLE);                          // // check I3C disabled
+    }                                                                        //
+    if (i3c_disable != LSM6DSO32_I3C_DISABLE)                                // check I3C disabled
+        return -1;                                                           //
     result |= lsm6dso32_block_data_update_set(dev_ctx, PROPERTY_ENABLE);     // Enable Block Data Update
+    result |= lsm6dso32_auto_increment_set(dev_ctx, PROPERTY_ENABLE);        // Address auto-increment for burst reads
     result |= lsm6dso32_fifo_mode_set(dev_ctx, LSM6DSO32_BYPASS_MODE);       // Bypass FIFO
     result |= lsm6dso32_xl_data_rate_set(dev_ctx, XL_ODR);                   // Set XL Output Data Rate
     result |= lsm6dso32_xl_full_scale_set(dev_ctx, LSM6DSO32_4g);            // Set XL full scale
     result |= lsm6dso32_gy_data_rate_set(dev_ctx, GY_ODR);                   // Set G Output Data Rate
     result |= lsm6dso32_gy_full_scale_set(dev_ctx, LSM6DSO32_2000dps);       // Set G full scale
     result |= lsm6dso32_timestamp_set(dev_ctx, PROPERTY_ENABLE);             // Enable timestamp
-#ifdef IMU_POWER_OFF                                                         //
+#if defined IMU_POWER_OFF                                                    //
     int1_ctrl.int1_ctrl.int1_drdy_xl = PROPERTY_ENABLE;                      // xl data ready enable
     int2_ctrl.int2_ctrl.int2_drdy_g = PROPERTY_ENABLE;                       // g data ready enable
     result |= lsm6dso32_data_ready_mode_set(dev_ctx, LSM6DSO32_DRDY_PULSED); // set data ready to pulsed
     result |= lsm6dso32_pin_int1_route_set(dev_ctx, &int1_ctrl);             // xl data ready on int1
     result |= lsm6dso32_pin_int2_route_set(dev_ctx, &int2_ctrl);             // g data ready on int2
+#elif defined IMU_DRDY                                                       //
+    int1_ctrl.int1_ctrl.int1_drdy_g = PROPERTY_ENABLE;                       // g data ready, xl shares the ODR
+    result |= lsm6dso32_data_ready_mode_set(dev_ctx, LSM6DSO32_DRDY_PULSED); // one pulse per sample
+    result |= lsm6dso32_pin_int1_route_set(dev_ctx, &int1_ctrl);             // g data ready on int1
+    (void)int2_ctrl;                                                         //
+#elif defined IMU_LOW_LATENCY                                                //
+    int1_ctrl.int1_ctrl.int1_drdy_g = PROPERTY_ENABLE;                       // g data ready, xl shares the ODR
+    result |= lsm6dso32_data_ready_mode_set(dev_ctx, LSM6DSO32_DRDY_PULSED); // one pulse per sample
+    result |= lsm6dso32_pin_int1_route_set(dev_ctx, &int1_ctrl);             // g data ready on int1
+    (void)int2_ctrl;                                                         //
+#elif defined IMU_DMA_READ                                                   //
+    int1_ctrl.int1_ctrl.int1_drdy_xl = PROPERTY_ENABLE;                      // xl or g data ready,
+    int1_ctrl.int1_ctrl.int1_drdy_g = PROPERTY_ENABLE;                       // paces the DMA read retries
+    result |= lsm6dso32_data_ready_mode_set(dev_ctx, LSM6DSO32_DRDY_PULSED); //
+    result |= lsm6dso32_pin_int1_route_set(dev_ctx, &int1_ctrl);             // both on int1
+    (void)int2_ctrl;                                                         //
 #endif
     return result;
 }
@@ -149,42 +271,289 @@ int32_t imu_init(stmdev_ctx_t *dev_ctx)
 int32_t imu_get_packet_data(stmdev_ctx_t *dev_ctx, uint16_t *buf)
 {
     int32_t result = 0;
-    uint8_t whoamI = 0;
-    uint8_t drdy = 0;
-    lsm6dso32_reg_t reg;
+    lsm6dso32_status_reg_t status;
+    bool active = true;
 
     do
     {
-        lsm6dso32_status_reg_get(dev_ctx, &reg.status_reg); // get data ready flags
-    } while (!reg.status_reg.gda | !reg.status_reg.xlda);   // until xl/g data is ready
-
-    result |= lsm6dso32_timestamp_raw_get(dev_ctx, (uint32_t *)buf); // read timestamp, 4 bytes
-
-    if (reg.status_reg.tda)                                        // if temperature data ready
-        result |= lsm6dso32_temperature_raw_get(dev_ctx, buf + 2); // read temperature, 2 bytes
-    // else                                                           // else
-    //     *(buf + 2) = (uint16_t)0;                                  // set to zero
-
-    if (reg.status_reg.gda)                                         // if g data ready
-        result |= lsm6dso32_angular_rate_raw_get(dev_ctx, buf + 3); // read angular rate, 6 bytes
-    // else                                                            // else
-    // {                                                               //
-    //     *(buf + 3) = (uint16_t)0;                                   // set to zero
-    //     *(buf + 4) = (uint16_t)0;
-    //     *(buf + 5) = (uint16_t)0;
-    // }
-    if (reg.status_reg.xlda)                                        // if xl data ready
-        result |= lsm6dso32_acceleration_raw_get(dev_ctx, buf + 6); // read acceleration, 6 bytes
-    // else                                                            // else
-    // {                                                               //
-    //     *(buf + 6) = (uint16_t)0;                                   // set to zero
-    //     *(buf + 7) = (uint16_t)0;
-    //     *(buf + 8) = (uint16_t)0;
-    // }
+        result |= lsm6dso32_status_reg_get(dev_ctx, &status);          // status alone while waiting, 2 bytes on the bus
+        if (imu_gy_sleeps && status.xlda && !status.gda && result == 0)
+            result |= imu_activity_get(dev_ctx, &active);              // gda never sets while the gyro is off
+    } while ((!status.xlda || (!status.gda && active)) && result == 0); // until xl/g data is ready
+
+    result |= lsm6dso32_read_reg(dev_ctx, LSM6DSO32_OUT_TEMP_L,       // temperature, angular rate, acceleration,
+                                 (uint8_t *)(buf + 2), 14);            // 14 bytes in one burst, relies on IF_INC
+    result |= lsm6dso32_read_reg(dev_ctx, LSM6DSO32_TIMESTAMP0,       // read timestamp, 4 bytes
+                                 (uint8_t *)buf, 4);                   //
+    if (!active)                                                       //
+        memset(buf + 3, 0, 6);                                         // no angular rate while inactive
+
+    return result;
+}
+
+#ifdef IMU_FIFO
+int32_t imu_fifo_init(stmdev_ctx_t *dev_ctx, uint16_t watermark)
+{
+    int32_t result = 0;
+    result |= lsm6dso32_fifo_watermark_set(dev_ctx, watermark);          // FIFO_WTM_IA above this many words
+    result |= lsm6dso32_fifo_xl_batch_set(dev_ctx, XL_BDR);              // batch xl at its ODR
+    result |= lsm6dso32_fifo_gy_batch_set(dev_ctx, GY_BDR);              // batch g at its ODR
+    result |= lsm6dso32_fifo_mode_set(dev_ctx, LSM6DSO32_BYPASS_MODE);   // empty the FIFO
+    result |= lsm6dso32_fifo_mode_set(dev_ctx, LSM6DSO32_STREAM_MODE);   // keep the newest samples on overrun
+    return result;
+}
+#endif
+
+int32_t imu_fifo_read(stmdev_ctx_t *dev_ctx, uint8_t *buf, uint16_t max_samples, uint16_t *n_samples)
+{
+    static uint8_t gy[6], xl[6];                                         // a pair may straddle two wakes
+    static bool have_gy = false, have_xl = false;                        //
+    int32_t result = 0;
+    uint16_t level = 0;
+    uint8_t word[7];                                                     // tag, x, y, z
+
+    *n_samples = 0;
+    result |= lsm6dso32_fifo_data_level_get(dev_ctx, &level);            // unread words
+    while (level-- && *n_samples < max_samples && result == 0)
+    {
+        result |= lsm6dso32_read_reg(dev_ctx, LSM6DSO32_FIFO_DATA_OUT_TAG, word, sizeof(word));
+        switch (word[0] >> 3)                                            // TAG_SENSOR[4:0]
+        {
+        case LSM6DSO32_GYRO_NC_TAG:
+            memcpy(gy, &word[1], 6);
+            have_gy = true;
+            break;
+        case LSM6DSO32_XL_NC_TAG:
+            memcpy(xl, &word[1], 6);
+            have_xl = true;
+            break;
+        default:                                                         // nothing else is batched
+            break;
+        }
+        if (have_gy && have_xl)
+        {
+            memcpy(buf, gy, 6);                                          // angular rate, 6 bytes
+            memcpy(buf + 6, xl, 6);                                      // acceleration, 6 bytes
+            buf += IMU_FIFO_SAMPLE_SIZE;
+            (*n_samples)++;
+            have_gy = have_xl = false;
+        }
+    }
+    return result;
+}
+
+int32_t imu_activity_init(stmdev_ctx_t *dev_ctx, uint8_t wake_ths, uint8_t wake_dur, uint8_t sleep_dur)
+{
+    int32_t result = 0;
+    lsm6dso32_pin_int1_route_t int1_ctrl;
+
+    result |= lsm6dso32_wkup_ths_weight_set(dev_ctx, LSM6DSO32_LSb_FS_DIV_256);  // fine threshold steps
+    result |= lsm6dso32_wkup_threshold_set(dev_ctx, wake_ths);                    //
+    result |= lsm6dso32_wkup_dur_set(dev_ctx, wake_dur);                          // samples over threshold to go active
+    result |= lsm6dso32_act_sleep_dur_set(dev_ctx, sleep_dur);                    // quiet time to go inactive
+    result |= lsm6dso32_act_pin_notification_set(dev_ctx, LSM6DSO32_DRIVE_SLEEP_CHG_EVENT); // one pulse per transition
+    result |= lsm6dso32_act_mode_set(dev_ctx, LSM6DSO32_XL_12Hz5_GY_PD);          // inactive: xl 12.5 Hz, g off
+    result |= lsm6dso32_pin_int1_route_get(dev_ctx, &int1_ctrl);                  // keep other int1 sources
+    int1_ctrl.md1_cfg.int1_sleep_change = PROPERTY_ENABLE;                        // sleep change on int1
+    result |= lsm6dso32_pin_int1_route_set(dev_ctx, &int1_ctrl);                  // also sets INTERRUPTS_ENABLE
+    imu_gy_sleeps = true;                                                         // imu_get_packet_data() stops waiting for g
+    return result;
+}
+
+int32_t imu_activity_get(stmdev_ctx_t *dev_ctx, bool *active)
+{
+    lsm6dso32_wake_up_src_t src;
+    int32_t result = lsm6dso32_read_reg(dev_ctx, LSM6DSO32_WAKE_UP_SRC, (uint8_t *)&src, 1);
 
+    *active = (src.sleep_state == 0);
     return result;
 }
 
+void imu_dma_init(void)
+{
+    LL_AHB_EnableClock(LL_AHB_PERIPH_DMA);
+
+    /* RX: SPI2 data register to imu_dma_rx */
+    LL_DMA_SetPeriphRequest(DMA1, IMU_DMA_RX_CHANNEL, LL_DMAMUX_REQ_SPI2_RX);
+    LL_DMA_SetDataTransferDirection(DMA1, IMU_DMA_RX_CHANNEL, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+    LL_DMA_SetChannelPriorityLevel(DMA1, IMU_DMA_RX_CHANNEL, LL_DMA_PRIORITY_LOW); // below the backscatter channel 3
+    LL_DMA_SetMode(DMA1, IMU_DMA_RX_CHANNEL, LL_DMA_MODE_NORMAL);
+    LL_DMA_SetPeriphIncMode(DMA1, IMU_DMA_RX_CHANNEL, LL_DMA_PERIPH_NOINCREMENT);
+    LL_DMA_SetMemoryIncMode(DMA1, IMU_DMA_RX_CHANNEL, LL_DMA_MEMORY_INCREMENT);
+    LL_DMA_SetPeriphSize(DMA1, IMU_DMA_RX_CHANNEL, LL_DMA_PDATAALIGN_BYTE);
+    LL_DMA_SetMemorySize(DMA1, IMU_DMA_RX_CHANNEL, LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_ConfigAddresses(DMA1, IMU_DMA_RX_CHANNEL, LL_SPI_DMA_GetRegAddr(IMU_SPI_MASTER), (uint32_t)imu_dma_rx, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+    LL_DMA_EnableIT_TC(DMA1, IMU_DMA_RX_CHANNEL);
+    LL_DMA_EnableIT_TE(DMA1, IMU_DMA_RX_CHANNEL);
+
+    /* TX: imu_dma_tx to SPI2 data register, completion is taken from RX */
+    LL_DMA_SetPeriphRequest(DMA1, IMU_DMA_TX_CHANNEL, LL_DMAMUX_REQ_SPI2_TX);
+    LL_DMA_SetDataTransferDirection(DMA1, IMU_DMA_TX_CHANNEL, LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+    LL_DMA_SetChannelPriorityLevel(DMA1, IMU_DMA_TX_CHANNEL, LL_DMA_PRIORITY_LOW);
+    LL_DMA_SetMode(DMA1, IMU_DMA_TX_CHANNEL, LL_DMA_MODE_NORMAL);
+    LL_DMA_SetPeriphIncMode(DMA1, IMU_DMA_TX_CHANNEL, LL_DMA_PERIPH_NOINCREMENT);
+    LL_DMA_SetMemoryIncMode(DMA1, IMU_DMA_TX_CHANNEL, LL_DMA_MEMORY_INCREMENT);
+    LL_DMA_SetPeriphSize(DMA1, IMU_DMA_TX_CHANNEL, LL_DMA_PDATAALIGN_BYTE);
+    LL_DMA_SetMemorySize(DMA1, IMU_DMA_TX_CHANNEL, LL_DMA_MDATAALIGN_BYTE);
+    LL_DMA_ConfigAddresses(DMA1, IMU_DMA_TX_CHANNEL, (uint32_t)imu_dma_tx, LL_SPI_DMA_GetRegAddr(IMU_SPI_MASTER), LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+    LL_DMA_EnableIT_TE(DMA1, IMU_DMA_TX_CHANNEL);
+
+    NVIC_SetPriority(DMA_IRQn, 0);
+    NVIC_EnableIRQ(DMA_IRQn);
+
+#ifdef IMU_DMA_READ
+    imu_interrupt_init(); // DRDY retries a read that found no new sample
+    imu_interrupt_disable();
+#endif
+}
+
+static void imu_dma_transfer(uint8_t reg, uint16_t len)
+{
+    imu_dma_tx[0] = reg | 0x80;                                                             // read, auto-increment from reg
+    for (uint16_t i = 1; i < len; i++)                                                      //
+        imu_dma_tx[i] = 0;                                                                  //
+
+    LL_AHB_EnableClock(LL_AHB_PERIPH_DMA);                                                  // may be gated by SPI_DMA_Uninit
+    LL_DMA_SetDataLength(DMA1, IMU_DMA_RX_CHANNEL, len);                                    //
+    LL_DMA_SetDataLength(DMA1, IMU_DMA_TX_CHANNEL, len);                                    //
+    HAL_GPIO_WritePin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS, GPIO_PIN_RESET); // NSS low
+    LL_SPI_EnableDMAReq_RX(IMU_SPI_MASTER);                                                 // RX first, so no byte is missed
+    LL_DMA_EnableChannel(DMA1, IMU_DMA_RX_CHANNEL);                                         //
+    LL_DMA_EnableChannel(DMA1, IMU_DMA_TX_CHANNEL);                                         //
+    LL_SPI_EnableDMAReq_TX(IMU_SPI_MASTER);                                                 //
+    LL_SPI_Enable(IMU_SPI_MASTER);                                                          // HAL leaves SPE set, no-op then
+}
+
+static void imu_dma_transfer_end(void)
+{
+    LL_DMA_DisableChannel(DMA1, IMU_DMA_RX_CHANNEL);
+    LL_DMA_DisableChannel(DMA1, IMU_DMA_TX_CHANNEL);
+    LL_SPI_DisableDMAReq_TX(IMU_SPI_MASTER);
+    LL_SPI_DisableDMAReq_RX(IMU_SPI_MASTER);
+    HAL_GPIO_WritePin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS, GPIO_PIN_SET); // NSS high
+}
+
+int32_t imu_get_packet_data_start(uint16_t *buf)
+{
+    if (imu_dma_state != IMU_DMA_IDLE)
+        return -1;
+
+    imu_dma_buf = buf;
+    imu_dma_result = 0;
+    imu_dma_state = IMU_DMA_STATUS;
+    imu_dma_transfer(LSM6DSO32_STATUS_REG, IMU_DMA_STATUS_LEN);
+    return 0;
+}
+
+bool imu_get_packet_data_done(void)
+{
+    return imu_dma_state == IMU_DMA_IDLE;
+}
+
+int32_t imu_get_packet_data_result(void)
+{
+    return imu_dma_result;
+}
+
+static void imu_latch_sample(void)
+{
+    imu_get_packet_data_start(imu_latch[imu_latch_write]); // still busy: skip, the next pulse gets it
+}
+
+void imu_drdy_latch_init(void)
+{
+    imu_dma_init();
+    imu_interrupt_init();
+}
+
+void imu_drdy_latch_pause(void)
+{
+    imu_interrupt_disable();
+    while (imu_dma_state != IMU_DMA_IDLE && imu_dma_state != IMU_DMA_WAIT)
+        ; // the DMA interrupt finishes the running read
+    imu_dma_state = IMU_DMA_IDLE; // a read waiting for the next pulse is dropped
+    imu_latch_ready = 0xFF;       // nothing latched until resumed
+}
+
+void imu_drdy_latch_resume(void)
+{
+    HAL_EXTI_ClearPending(&HEXTI_InitStructure);
+    imu_interrupt_enable();
+}
+
+#ifdef IMU_LOW_LATENCY
+bool imu_drdy_time(uint32_t *drdy_us)
+{
+    bool seen = imu_drdy_seen; // before the time, the interrupt writes them the other way round
+
+    *drdy_us = imu_drdy_us;
+    return seen;
+}
+#endif
+
+bool imu_get_latest_packet_data(uint16_t *buf)
+{
+    bool valid;
+
+    __disable_irq(); // the DMA interrupt swaps the halves
+    valid = imu_latch_ready < 2;
+    if (valid)
+        memcpy(buf, imu_latch[imu_latch_ready], sizeof(imu_latch[0]));
+    __enable_irq();
+    return valid;
+}
+
+void DMA_Shared_IRQHandler(void)
+{
+    if (LL_DMA_IsActiveFlag_TE1(DMA1) || LL_DMA_IsActiveFlag_TE2(DMA1))
+    {
+        LL_DMA_ClearFlag_GI1(DMA1);
+        LL_DMA_ClearFlag_GI2(DMA1);
+        imu_dma_transfer_end();
+        imu_dma_result = -1;
+        imu_dma_state = IMU_DMA_IDLE;
+        return;
+    }
+
+    if (!LL_DMA_IsActiveFlag_TC1(DMA1))
+        return;
+    LL_DMA_ClearFlag_GI1(DMA1);
+    LL_DMA_ClearFlag_GI2(DMA1);
+    imu_dma_transfer_end();
+
+    if (imu_dma_state == IMU_DMA_STATUS)
+    {
+        lsm6dso32_status_reg_t *status = (lsm6dso32_status_reg_t *)&imu_dma_rx[1];
+        if (!status->gda || !status->xlda)
+        {
+            /* not from here back to back, that would take DMA cycles from the backscatter TX */
+            imu_dma_state = IMU_DMA_WAIT;
+#ifdef IMU_DMA_READ
+            imu_interrupt_enable();
+#endif
+            return;
+        }
+        imu_dma_state = IMU_DMA_BURST;
+        imu_dma_transfer(LSM6DSO32_OUT_TEMP_L, IMU_DMA_BURST_LEN);
+    }
+    else if (imu_dma_state == IMU_DMA_BURST)
+    {
+        memcpy(imu_dma_buf + 2, &imu_dma_rx[1], 14); // temperature, angular rate, acceleration, 14 bytes
+        imu_dma_state = IMU_DMA_TIMESTAMP;
+        imu_dma_transfer(LSM6DSO32_TIMESTAMP0, IMU_DMA_TS_LEN);
+    }
+    else if (imu_dma_state == IMU_DMA_TIMESTAMP)
+    {
+        memcpy(imu_dma_buf, &imu_dma_rx[1], 4); // timestamp, 4 bytes
+        imu_dma_state = IMU_DMA_IDLE;
+        if (imu_dma_buf == imu_latch[imu_latch_write])
+        {
+            imu_latch_ready = imu_latch_write; // publish, DMA moves to the other half
+            imu_latch_write ^= 1;
+        }
+    }
+}
+
 int32_t imu_power_off(stmdev_ctx_t *dev_ctx)
 {
     int32_t result = 0;
@@ -198,44 +567,50 @@ int32_t imu_power_on(stmdev_ctx_t *dev_ctx)
     int32_t result = 0;
     result |= lsm6dso32_xl_data_rate_set(dev_ctx, XL_ODR); // xl power up
     result |= lsm6dso32_gy_data_rate_set(dev_ctx, GY_ODR); // g power up
+    return result;
+}
+
+/* one full duplex byte on SPI2, the RX FIFO threshold is 8 bit, -1 if the SPI stalls */
+static inline int32_t imu_spi_transfer(uint8_t tx, uint8_t *rx)
+{
+    uint32_t spin = IMU_SPI_SPIN_MAX;
+
+    while (!LL_SPI_IsActiveFlag_TXE(IMU_SPI_MASTER))
+        if (--spin == 0)
+            return -1;
+    LL_SPI_TransmitData8(IMU_SPI_MASTER, tx);
+    spin = IMU_SPI_SPIN_MAX;
+    while (!LL_SPI_IsActiveFlag_RXNE(IMU_SPI_MASTER))
+        if (--spin == 0)
+            return -1;
+    *rx = LL_SPI_ReceiveData8(IMU_SPI_MASTER);
     return 0;
 }
 
 int32_t platform_write(void *handle, uint8_t Reg, const uint8_t *Bufp, uint16_t len)
 {
-    HAL_GPIO_WritePin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS, GPIO_PIN_RESET); // NSS low
-    for (uint16_t i = 1; i <= len; i++)                                                     // iterate over aTxBuffer
-        aTxBuffer[i] = Bufp[i - 1];                                                         // set aTxBuffer to zero
-    aTxBuffer[0] = Reg;                                                                     // add Reg to aTxBuffer
-    ubNbDataToTransmit = len + 1;                                                           // set data to transmit
-    uint8_t success = HAL_SPI_Transmit(                                                     //
-        &hspiMaster, (uint8_t *)aTxBuffer, ubNbDataToTransmit, 10);                         // transmit
-    HAL_GPIO_WritePin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS, GPIO_PIN_SET);   // NSS high
-    if (success != HAL_OK)                                                                  // check for success
-        return -1;
-    else
-        return 0;
+    int32_t result;
+    uint8_t rx;
+
+    LL_GPIO_ResetOutputPin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS); // NSS low
+    result = imu_spi_transfer(Reg, &rx);                                         // register address
+    for (uint16_t i = 0; i < len && result == 0; i++)                            // data straight from Bufp
+        result = imu_spi_transfer(Bufp[i], &rx);                                 //
+    LL_GPIO_SetOutputPin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS);   // NSS high
+    return result;
 }
 
 int32_t platform_read(void *handle, uint8_t Reg, uint8_t *Bufp, uint16_t len)
 {
-    HAL_GPIO_WritePin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS, GPIO_PIN_RESET); // NSS low
-    for (uint16_t i = 0; i <= len; i++)                                                     // iterate over buffers
-    {                                                                                       //
-        aTxBuffer[i] = 0;                                                                   // set aTxBuffer to zero
-        aRxBuffer[i] = 0;                                                                   // set aRxBuffer to zero
-    }                                                                                       //
-    aTxBuffer[0] = Reg | 0x80;                                                              // add Reg to aTxbuffer
-    ubNbDataToTransmit = len + 1;                                                           // set data to transmit
-    uint8_t success = HAL_SPI_TransmitReceive(                                              //
-        &hspiMaster, (uint8_t *)aTxBuffer, (uint8_t *)aRxBuffer, ubNbDataToTransmit, 10);   // transmit
-    HAL_GPIO_WritePin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS, GPIO_PIN_SET);   // NSS high
-    for (uint16_t i = 0; i < len; i++)                                                      // copy results to Bufp
-        Bufp[i] = aRxBuffer[i + 1];                                                         //
-    if (success != HAL_OK)                                                                  // check for success
-        return -1;
-    else
-        return 0;
+    int32_t result;
+    uint8_t rx;
+
+    LL_GPIO_ResetOutputPin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS); // NSS low
+    result = imu_spi_transfer(Reg | 0x80, &rx);                                  // register address, read
+    for (uint16_t i = 0; i < len && result == 0; i++)                            // data straight into Bufp
+        result = imu_spi_transfer(0x00, &Bufp[i]);                               //
+    LL_GPIO_SetOutputPin(IMU_GPIO_PORT_MASTER_CS, IMU_GPIO_PIN_SPI_MASTER_CS);   // NSS high
+    return result;
 }
 
 void MX_SPI_MASTER_Init(void)
@@ -250,7 +625,7 @@ void MX_SPI_MASTER_Init(void)
     hspiMaster.Init.CLKPhase = SPI_PHASE_2EDGE;
     hspiMaster.Init.DataSize = SPI_DATASIZE_8BIT;
     hspiMaster.Init.NSS = SPI_NSS_SOFT;
-    hspiMaster.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_4;
+    hspiMaster.Init.BaudRatePrescaler = IMU_SPI_PRESCALER;
     hspiMaster.Init.FirstBit = SPI_FIRSTBIT_MSB;
     hspiMaster.Init.TIMode = SPI_TIMODE_DISABLE;
     hspiMaster.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
@@ -262,6 +637,7 @@ void MX_SPI_MASTER_Init(void)
         while (1)
             ;
     }
+    LL_SPI_Enable(IMU_SPI_MASTER); // platform_read/write drive the registers directly
 }
 
 void HAL_SPI_MspInit(SPI_HandleTypeDef *hspi)
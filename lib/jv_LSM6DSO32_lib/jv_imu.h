@@ -18,15 +18,15 @@
 #define INC_IMU_H_
 
 #include <main.h>
+#include <stdbool.h>
 #include "LSM6DSO32/lsm6dso32_reg.h"
 #include "rf_driver_hal.h"
 #include "rf_driver_hal_power_manager.h"
 #include "rf_device_hal_conf.h"
 
+#define IMU_FIFO_SAMPLE_SIZE 12 // gyro xyz, accel xyz
+
 extern SPI_HandleTypeDef hspiMaster;
-extern uint8_t aTxBuffer[];
-extern uint8_t ubNbDataToTransmit;
-extern uint8_t aRxBuffer[];
 
 void imu_interrupt_init(void);
 void imu_interrupt_enable(void);
@@ -36,20 +36,179 @@ void imu_EXTI_callback(uint32_t Line);
 /**
  * @brief Initalize the IMU for backscatter demo
  *
+ * Waits for the device ID, then for the boot and software reset bits to
+ * clear, polled on jv_delayUS() with fixed time bounds. Call jv_delayUS_Init()
+ * first. Stops at the first step that times out.
+ *
  * @param dev_ctx Device handle
- * @return int32_t 0 if successful, else -1
+ * @return int32_t 0 if successful, -1 if the IMU does not answer, boot or reset in time
  */
 int32_t imu_init(stmdev_ctx_t *dev_ctx);
 
 /**
  * @brief Read data from the IMU and store it in a buffer for transmission
  *
+ * STATUS_REG is polled on its own until gyro and accel data are ready, then
+ * OUT_TEMP_L through OUTZ_H_A are read in one burst and the 4 timestamp bytes
+ * in another, so a wait for the sensor only moves 2 bytes per poll. After
+ * imu_activity_init() an inactive IMU only waits for accel data and reports
+ * a zero angular rate, the gyro is powered down then.
+ * Buffer layout: timestamp (4), temperature (2), gyro xyz (6), accel xyz (6).
+ *
  * @param dev_ctx Device handle
  * @param buf Buffer to store 18 bytes of IMU data
  * @return int32_t 0 if successful, else -1
  */
 int32_t imu_get_packet_data(stmdev_ctx_t *dev_ctx, uint16_t *buf);
 
+/**
+ * @brief Switch the IMU FIFO from bypass to stream mode
+ *
+ * Gyro and accel are batched at XL_BDR/GY_BDR from main.h, so the sensor keeps
+ * sampling between wakes and imu_fifo_read() collects everything since the
+ * last one. Call after imu_init(). Emptying the FIFO is part of the switch.
+ * Only built with IMU_FIFO defined.
+ *
+ * @param dev_ctx Device handle
+ * @param watermark FIFO threshold in words, one word per sensor per sample
+ * @return int32_t 0 if successful, else -1
+ */
+int32_t imu_fifo_init(stmdev_ctx_t *dev_ctx, uint16_t watermark);
+
+/**
+ * @brief Read the gyro/accel samples stored in the FIFO
+ *
+ * One SPI transaction per FIFO word. Words are paired into samples of
+ * IMU_FIFO_SAMPLE_SIZE bytes: gyro xyz (6), accel xyz (6), oldest first. Stops
+ * at max_samples, the rest stays in the FIFO for the next call.
+ *
+ * @param dev_ctx Device handle
+ * @param buf Buffer for max_samples * IMU_FIFO_SAMPLE_SIZE bytes
+ * @param max_samples Maximum number of samples to read
+ * @param n_samples Number of samples written to buf
+ * @return int32_t 0 if successful, else -1
+ */
+int32_t imu_fifo_read(stmdev_ctx_t *dev_ctx, uint8_t *buf, uint16_t max_samples, uint16_t *n_samples);
+
+/**
+ * @brief Enable the IMU activity/inactivity detection with a sleep change interrupt on INT1
+ *
+ * The IMU goes active after more than wake_dur + 1 samples above wake_ths and
+ * back to inactive after sleep_dur * 512 samples below it, so the two
+ * transitions have their own delay. While inactive the accelerometer runs at
+ * 12.5 Hz and the gyro is powered down, the configured ODRs come back with
+ * the activity. imu_get_packet_data() follows this, the DMA reads do not.
+ * INT1 pulses on each transition, call imu_interrupt_init() to catch it.
+ * Call after imu_init().
+ *
+ * @param dev_ctx Device handle
+ * @param wake_ths Wake-up threshold, FS_XL / 256 per LSB (15.6 mg at 4 g), 0 to 63
+ * @param wake_dur Samples above wake_ths before going active, 0 to 3
+ * @param sleep_dur Inactivity time before going inactive, 512 / ODR_XL per LSB, 0 to 15
+ * @return int32_t 0 if successful, else -1
+ */
+int32_t imu_activity_init(stmdev_ctx_t *dev_ctx, uint8_t wake_ths, uint8_t wake_dur, uint8_t sleep_dur);
+
+/**
+ * @brief Read the activity state set up by imu_activity_init()
+ *
+ * @param dev_ctx Device handle
+ * @param active true while the IMU reports activity
+ * @return int32_t 0 if successful, else -1
+ */
+int32_t imu_activity_get(stmdev_ctx_t *dev_ctx, bool *active);
+
+/**
+ * @brief Configure DMA1 channels 1 (SPI2 RX) and 2 (SPI2 TX) for imu_get_packet_data_start()
+ *
+ * Call after MX_SPI_MASTER_Init(). Channel 3 stays with the backscatter SPI1 TX
+ * and has the higher DMA priority. With IMU_DMA_READ defined this also sets up
+ * the INT1 interrupt, imu_init() routes the data ready pulses there.
+ *
+ */
+void imu_dma_init(void);
+
+/**
+ * @brief Start the imu_get_packet_data() reads on DMA and return immediately
+ *
+ * The same buffer layout as imu_get_packet_data(), run from the DMA interrupt,
+ * so the read overlaps with the backscatter TX: STATUS_REG alone, then the
+ * outputs and the timestamp once gyro and accel data are ready. A status
+ * without new data is read again on the next data ready pulse on INT1, never
+ * straight from the DMA interrupt. buf is written from the interrupt, do not
+ * touch it or use the blocking IMU functions until imu_get_packet_data_done()
+ * returns true.
+ *
+ * @param buf Buffer to store 18 bytes of IMU data
+ * @return int32_t 0 if started, -1 if a read is still running
+ */
+int32_t imu_get_packet_data_start(uint16_t *buf);
+
+/**
+ * @brief Check if the read started with imu_get_packet_data_start() is complete
+ *
+ */
+bool imu_get_packet_data_done(void);
+
+/**
+ * @brief Result of the last completed DMA read
+ *
+ * @return int32_t 0 if successful, -1 on a DMA transfer error
+ */
+int32_t imu_get_packet_data_result(void);
+
+/**
+ * @brief Latch every new sample in the background, started by the DRDY interrupt
+ *
+ * With IMU_DRDY defined imu_init() routes a pulsed gyro DRDY to INT1. Each pulse
+ * starts imu_get_packet_data_start() into one half of a double buffer, the
+ * other half holds the newest complete sample. No SPI traffic or waiting is
+ * left in the TX loop. Do not use other IMU SPI calls afterwards, except
+ * between imu_drdy_latch_pause() and imu_drdy_latch_resume(). Call after
+ * imu_init() and MX_SPI_MASTER_Init().
+ *
+ */
+void imu_drdy_latch_init(void);
+
+/**
+ * @brief Stop the DRDY latch, so the blocking IMU functions can use SPI2
+ *
+ * Waits for a running read to finish. The latched sample is dropped, so the
+ * first one after imu_drdy_latch_resume() is new.
+ *
+ */
+void imu_drdy_latch_pause(void);
+
+/**
+ * @brief Restart the DRDY latch stopped with imu_drdy_latch_pause()
+ *
+ */
+void imu_drdy_latch_resume(void);
+
+/**
+ * @brief jv_timeUS() of the last DRDY pulse, IMU_LOW_LATENCY
+ *
+ * With IMU_LOW_LATENCY defined imu_init() routes a pulsed gyro DRDY to INT1 and
+ * imu_EXTI_callback() records the time of each pulse, so a sample read with
+ * imu_get_packet_data() can be dated to when the sensor produced it. Call
+ * imu_interrupt_init() first. A pulse missed with the interrupt off or in
+ * DEEPSTOP leaves an older time.
+ *
+ * @param drdy_us Time of the last pulse
+ * @return true if a pulse was seen since imu_interrupt_init()
+ */
+bool imu_drdy_time(uint32_t *drdy_us);
+
+/**
+ * @brief Copy the newest sample latched since imu_drdy_latch_init()
+ *
+ * Same buffer layout as imu_get_packet_data(). Never waits for the sensor.
+ *
+ * @param buf Buffer to store 18 bytes of IMU data, unchanged if nothing is latched yet
+ * @return true if buf was written
+ */
+bool imu_get_latest_packet_data(uint16_t *buf);
+
 /**
  * @brief Power off the XL and GY independently
  *
@@ -69,6 +228,8 @@ int32_t imu_power_on(stmdev_ctx_t *dev_ctx);
 /**
  * @brief Platform-specific SPI write function for IMU
  *
+ * LL register access on SPI2, one byte in flight, no HAL state. Each flag
+ * wait is bounded to a few byte times at the configured prescaler.
  * @param handle Device handle
  * @param Reg Reg to write to
  * @param Bufp Data to write to reg
@@ -80,6 +241,8 @@ int32_t platform_write(void *handle, uint8_t Reg, const uint8_t *Bufp, uint16_t
 /**
  * @brief Platform-specific SPI read function for IMU
  *
+ * LL register access on SPI2, data is clocked straight into Bufp. Same
+ * bounded flag waits as platform_write().
  * @param handle Device handle
  * @param Reg Reg to read from
  * @param Bufp Buffer to store read data
@@ -91,6 +254,8 @@ int32_t platform_read(void *handle, uint8_t Reg, uint8_t *Bufp, uint16_t len);
 /**
  * @brief SPI_MASTER Initialization Function
  *
+ * The prescaler is the smallest that keeps SCK within the LSM6DSO32 10 MHz
+ * limit for IMU_SPI_KERNEL_HZ, 8 MHz from the default 32 MHz kernel clock.
  */
 void MX_SPI_MASTER_Init(void);
 
@@ -0,0 +1,241 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_imu_codec.c
+ * @brief Delta + bit-packed compression of IMU samples for the BLE payload
+ * @date 2023-03-20
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ */
+
+#include <string.h>
+#include "jv_imu_codec.h"
+
+#define COUNT_BITS      3
+#define WIDTH5_BITS     5
+#define AXIS_WIDTH_BITS 4
+#define AXIS_WIDTH_16   15 // code for a full 16 bit axis delta
+#define AXES            6
+#define KEYFRAME_BITS   (16 + AXES * 16)
+
+typedef struct
+{
+    uint8_t *buf;
+    uint32_t pos; // bits
+} bit_writer_t;
+
+typedef struct
+{
+    const uint8_t *buf;
+    uint32_t pos; // bits
+} bit_reader_t;
+
+static void put_bits(bit_writer_t *w, uint32_t value, uint8_t bits)
+{
+    for (uint8_t i = 0; i < bits; i++, w->pos++)
+    {
+        if (value & (1UL << i))
+            w->buf[w->pos >> 3] |= (uint8_t)(1U << (w->pos & 7));
+    }
+}
+
+static uint32_t get_bits(bit_reader_t *r, uint8_t bits)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bits; i++, r->pos++)
+    {
+        if (r->buf[r->pos >> 3] & (1U << (r->pos & 7)))
+            value |= 1UL << i;
+    }
+    return value;
+}
+
+static uint8_t width_of(uint32_t value)
+{
+    uint8_t width = 0;
+    while (value)
+    {
+        width++;
+        value >>= 1;
+    }
+    return width;
+}
+
+static inline uint16_t zigzag16(int16_t v)
+{
+    return (uint16_t)(((uint16_t)v << 1) ^ (uint16_t)(v >> 15));
+}
+
+static inline int16_t unzigzag16(uint16_t v)
+{
+    return (int16_t)((v >> 1) ^ (uint16_t)-(int16_t)(v & 1));
+}
+
+static inline int16_t axis(const jv_imu_sample_t *s, uint8_t a)
+{
+    return a < 3 ? s->gyro[a] : s->accel[a - 3];
+}
+
+static inline int16_t *axis_ptr(jv_imu_sample_t *s, uint8_t a)
+{
+    return a < 3 ? &s->gyro[a] : &s->accel[a - 3];
+}
+
+static inline uint8_t axis_width_code(uint8_t width)
+{
+    return width < AXIS_WIDTH_16 ? width : AXIS_WIDTH_16;
+}
+
+static inline uint8_t axis_code_width(uint8_t code)
+{
+    return code < AXIS_WIDTH_16 ? code : 16;
+}
+
+/* widths and total bit count of the first n samples */
+typedef struct
+{
+    uint16_t dt0;
+    uint8_t dt0_width;
+    uint8_t jitter_width;
+    uint8_t axis_width[AXES];
+    uint32_t bits;
+} codec_plan_t;
+
+static void plan(const jv_imu_sample_t *samples, uint8_t n, codec_plan_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->bits = COUNT_BITS + KEYFRAME_BITS;
+    if (n < 2)
+        return;
+
+    p->dt0 = (uint16_t)(samples[1].timestamp - samples[0].timestamp);
+    p->dt0_width = width_of(p->dt0);
+    for (uint8_t i = 1; i < n; i++)
+    {
+        if (i >= 2)
+        {
+            uint16_t dt = (uint16_t)(samples[i].timestamp - samples[i - 1].timestamp);
+            uint8_t w = width_of(zigzag16((int16_t)(dt - p->dt0)));
+            if (w > p->jitter_width)
+                p->jitter_width = w;
+        }
+        for (uint8_t a = 0; a < AXES; a++)
+        {
+            uint8_t w = width_of(zigzag16((int16_t)(axis(&samples[i], a) - axis(&samples[i - 1], a))));
+            if (w > p->axis_width[a])
+                p->axis_width[a] = w;
+        }
+    }
+
+    uint32_t per_sample = 0;
+    for (uint8_t a = 0; a < AXES; a++)
+    {
+        p->axis_width[a] = axis_code_width(axis_width_code(p->axis_width[a])); // 15 is sent as 16
+        per_sample += p->axis_width[a];
+    }
+    p->bits += WIDTH5_BITS + p->dt0_width + WIDTH5_BITS + AXES * AXIS_WIDTH_BITS;
+    p->bits += (n - 1) * per_sample + (n - 2) * p->jitter_width;
+}
+
+void jv_imu_codec_from_packet_data(const uint16_t *buf, jv_imu_sample_t *sample)
+{
+    sample->timestamp = buf[0];
+    for (uint8_t a = 0; a < 3; a++)
+    {
+        sample->gyro[a] = (int16_t)buf[3 + a];
+        sample->accel[a] = (int16_t)buf[6 + a];
+    }
+}
+
+size_t jv_imu_codec_encode(uint8_t *dst, size_t dst_len, const jv_imu_sample_t *samples, uint16_t n_samples, uint8_t *n_encoded)
+{
+    codec_plan_t p;
+    uint8_t n = n_samples < JV_IMU_CODEC_MAX_SAMPLES ? (uint8_t)n_samples : JV_IMU_CODEC_MAX_SAMPLES;
+
+    /* largest prefix that fits, widths only grow with n */
+    for (; n > 0; n--)
+    {
+        plan(samples, n, &p);
+        if (p.bits <= dst_len * 8)
+            break;
+    }
+    *n_encoded = n;
+    if (n == 0)
+        return 0;
+
+    bit_writer_t w = {dst, 0};
+    memset(dst, 0, dst_len);
+    put_bits(&w, n - 1, COUNT_BITS);
+    put_bits(&w, samples[0].timestamp, 16);
+    for (uint8_t a = 0; a < AXES; a++)
+        put_bits(&w, (uint16_t)axis(&samples[0], a), 16);
+
+    if (n >= 2)
+    {
+        put_bits(&w, p.dt0_width, WIDTH5_BITS);
+        put_bits(&w, p.dt0, p.dt0_width);
+        put_bits(&w, p.jitter_width, WIDTH5_BITS);
+        for (uint8_t a = 0; a < AXES; a++)
+            put_bits(&w, axis_width_code(p.axis_width[a]), AXIS_WIDTH_BITS);
+
+        for (uint8_t i = 1; i < n; i++)
+        {
+            if (i >= 2)
+            {
+                uint16_t dt = (uint16_t)(samples[i].timestamp - samples[i - 1].timestamp);
+                put_bits(&w, zigzag16((int16_t)(dt - p.dt0)), p.jitter_width);
+            }
+            for (uint8_t a = 0; a < AXES; a++)
+                put_bits(&w, zigzag16((int16_t)(axis(&samples[i], a) - axis(&samples[i - 1], a))), p.axis_width[a]);
+        }
+    }
+    return (w.pos + 7) >> 3;
+}
+
+uint8_t jv_imu_codec_decode(const uint8_t *src, size_t src_len, jv_imu_sample_t *samples)
+{
+    bit_reader_t r = {src, 0};
+    uint32_t avail = src_len * 8;
+    uint8_t axis_width[AXES];
+
+    if (avail < COUNT_BITS + KEYFRAME_BITS)
+        return 0;
+    uint8_t n = (uint8_t)get_bits(&r, COUNT_BITS) + 1;
+    samples[0].timestamp = (uint16_t)get_bits(&r, 16);
+    for (uint8_t a = 0; a < AXES; a++)
+        *axis_ptr(&samples[0], a) = (int16_t)get_bits(&r, 16);
+    if (n == 1)
+        return 1;
+
+    if (r.pos + WIDTH5_BITS > avail)
+        return 0;
+    uint8_t dt0_width = (uint8_t)get_bits(&r, WIDTH5_BITS);
+    if (r.pos + dt0_width + WIDTH5_BITS + AXES * AXIS_WIDTH_BITS > avail)
+        return 0;
+    uint16_t dt0 = (uint16_t)get_bits(&r, dt0_width);
+    uint8_t jitter_width = (uint8_t)get_bits(&r, WIDTH5_BITS);
+    uint32_t per_sample = 0;
+    for (uint8_t a = 0; a < AXES; a++)
+    {
+        axis_width[a] = axis_code_width((uint8_t)get_bits(&r, AXIS_WIDTH_BITS));
+        per_sample += axis_width[a];
+    }
+    if (r.pos + (n - 1) * per_sample + (n - 2) * jitter_width > avail)
+        return 0;
+
+    for (uint8_t i = 1; i < n; i++)
+    {
+        uint16_t dt = dt0;
+        if (i >= 2)
+            dt += (uint16_t)unzigzag16((uint16_t)get_bits(&r, jitter_width));
+        samples[i].timestamp = (uint16_t)(samples[i - 1].timestamp + dt);
+        for (uint8_t a = 0; a < AXES; a++)
+            *axis_ptr(&samples[i], a) = (int16_t)(axis(&samples[i - 1], a) + unzigzag16((uint16_t)get_bits(&r, axis_width[a])));
+    }
+    return n;
+}
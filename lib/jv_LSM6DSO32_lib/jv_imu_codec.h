@@ -0,0 +1,84 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_imu_codec.h
+ * @brief Delta + bit-packed compression of IMU samples for the BLE payload
+ * @date 2023-03-20
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Every packet decodes on its own, so a lost packet never corrupts the next
+ * one. Bit stream, LSB first:
+ *
+ *     3 bits   sample count - 1
+ *     112 bits keyframe: timestamp (16), gyro xyz, accel xyz (16 each)
+ *     if more than one sample:
+ *     5+w bits first timestamp delta, width w then value
+ *     5 bits   timestamp jitter width j
+ *     6x4 bits width per gyro/accel axis, 15 means 16
+ *     per further sample:
+ *         j bits   zigzag(timestamp delta - first timestamp delta), from the third sample
+ *         6 axes   zigzag(value - previous value) at the axis width
+ *
+ * The timestamp is meant to be a sample index, the receiver dates the samples
+ * from it and the ODR. No temperature is sent. No platform includes, the same
+ * file builds the host decoder, see test/jv_imu_codec_test_main.c.
+ *
+ */
+
+#ifndef INC_JV_IMU_CODEC_H_
+#define INC_JV_IMU_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JV_IMU_CODEC_MAX_SAMPLES 8  // 3 bit count
+#define JV_IMU_CODEC_MIN_LEN     15 // keyframe only
+
+typedef struct
+{
+    uint16_t timestamp; // sample index, or the low half of the LSM6DSO32 timestamp
+    int16_t gyro[3];
+    int16_t accel[3];
+} jv_imu_sample_t;
+
+/**
+ * @brief Convert the imu_get_packet_data() buffer layout into a sample
+ *
+ * Keeps the low 16 bits of the 25 us timestamp, which wrap every 1.6 s, and
+ * drops the temperature.
+ *
+ * @param buf 18 bytes of IMU data, as written by imu_get_packet_data()
+ * @param sample Destination sample
+ */
+void jv_imu_codec_from_packet_data(const uint16_t *buf, jv_imu_sample_t *sample);
+
+/**
+ * @brief Encode as many samples as fit into dst
+ *
+ * @param dst Destination payload
+ * @param dst_len Payload size in bytes, at least JV_IMU_CODEC_MIN_LEN
+ * @param samples Samples to encode, oldest first
+ * @param n_samples Number of samples available
+ * @param n_encoded Number of samples taken from the front of samples
+ * @return size_t Encoded length in bytes, 0 if nothing fits
+ */
+size_t jv_imu_codec_encode(uint8_t *dst, size_t dst_len, const jv_imu_sample_t *samples, uint16_t n_samples, uint8_t *n_encoded);
+
+/**
+ * @brief Decode a payload written by jv_imu_codec_encode()
+ *
+ * Trailing padding after the bit stream is ignored.
+ *
+ * @param src Encoded payload
+ * @param src_len Payload size in bytes
+ * @param samples Destination for up to JV_IMU_CODEC_MAX_SAMPLES samples
+ * @return uint8_t Number of decoded samples, 0 if the payload is truncated
+ */
+uint8_t jv_imu_codec_decode(const uint8_t *src, size_t src_len, jv_imu_sample_t *samples);
+
+#endif /* INC_JV_IMU_CODEC_H_ */
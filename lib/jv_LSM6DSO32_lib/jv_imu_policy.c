@@ -0,0 +1,225 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_imu_policy.c
+ * @brief Runtime choice of the IMU power mode and ODR for a packet rate
+ * @date 2023-03-24
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ */
+
+#include "jv_imu_policy.h"
+
+typedef struct
+{
+    uint32_t hz_x10;
+    lsm6dso32_odr_xl_t xl;
+    lsm6dso32_odr_g_t gy;
+    lsm6dso32_bdr_xl_t xl_bdr;
+    lsm6dso32_bdr_gy_t gy_bdr;
+    uint16_t ua; // xl + g typical
+} imu_odr_t;
+
+static const imu_odr_t odr_table[] = {
+    {125, LSM6DSO32_XL_ODR_12Hz5_LOW_PW, LSM6DSO32_GY_ODR_12Hz5_LOW_PW, LSM6DSO32_XL_BATCHED_AT_12Hz5, LSM6DSO32_GY_BATCHED_AT_12Hz5, 170},
+    {260, LSM6DSO32_XL_ODR_26Hz_LOW_PW, LSM6DSO32_GY_ODR_26Hz_LOW_PW, LSM6DSO32_XL_BATCHED_AT_26Hz, LSM6DSO32_GY_BATCHED_AT_26Hz, 210},
+    {520, LSM6DSO32_XL_ODR_52Hz_LOW_PW, LSM6DSO32_GY_ODR_52Hz_LOW_PW, LSM6DSO32_XL_BATCHED_AT_52Hz, LSM6DSO32_GY_BATCHED_AT_52Hz, 260},
+    {1040, LSM6DSO32_XL_ODR_104Hz_NORMAL_MD, LSM6DSO32_GY_ODR_104Hz_NORMAL_MD, LSM6DSO32_XL_BATCHED_AT_104Hz, LSM6DSO32_GY_BATCHED_AT_104Hz, 330},
+    {2080, LSM6DSO32_XL_ODR_208Hz_NORMAL_MD, LSM6DSO32_GY_ODR_208Hz_NORMAL_MD, LSM6DSO32_XL_BATCHED_AT_208Hz, LSM6DSO32_GY_BATCHED_AT_208Hz, 450},
+    {4170, LSM6DSO32_XL_ODR_417Hz_HIGH_PERF, LSM6DSO32_GY_ODR_417Hz_HIGH_PERF, LSM6DSO32_XL_BATCHED_AT_417Hz, LSM6DSO32_GY_BATCHED_AT_417Hz, 550},
+    {8330, LSM6DSO32_XL_ODR_833Hz_HIGH_PERF, LSM6DSO32_GY_ODR_833Hz_HIGH_PERF, LSM6DSO32_XL_BATCHED_AT_833Hz, LSM6DSO32_GY_BATCHED_AT_833Hz, 550},
+    {16670, LSM6DSO32_XL_ODR_1667Hz_HIGH_PERF, LSM6DSO32_GY_ODR_1667Hz_HIGH_PERF, LSM6DSO32_XL_BATCHED_AT_1667Hz, LSM6DSO32_GY_BATCHED_AT_1667Hz, 550},
+    {33330, LSM6DSO32_XL_ODR_3333Hz_HIGH_PERF, LSM6DSO32_GY_ODR_3333Hz_HIGH_PERF, LSM6DSO32_XL_BATCHED_AT_3333Hz, LSM6DSO32_GY_BATCHED_AT_3333Hz, 550},
+    {66670, LSM6DSO32_XL_ODR_6667Hz_HIGH_PERF, LSM6DSO32_GY_ODR_6667Hz_HIGH_PERF, LSM6DSO32_XL_BATCHED_AT_6667Hz, LSM6DSO32_GY_BATCHED_AT_6667Hz, 550},
+};
+
+#define ODR_COUNT (sizeof(odr_table) / sizeof(odr_table[0]))
+#define CYCLE_ODR (ODR_COUNT - 1) // fastest first sample after power-on
+
+extern volatile uint8_t data_ready;
+
+/* average current in nA of a charge in uA*us repeated rate_x10 / 10 times per second */
+static inline uint64_t charge_na(uint64_t ua_us, uint32_t rate_x10)
+{
+    return ua_us * rate_x10 / 10000;
+}
+
+static int8_t matched_odr(uint32_t rate_hz)
+{
+    for (uint8_t i = 0; i < ODR_COUNT; i++)
+    {
+        if (odr_table[i].hz_x10 >= rate_hz * 10)
+            return (int8_t)i;
+    }
+    return -1;
+}
+
+int32_t jv_imu_policy_plan(uint32_t rate_hz, uint32_t max_latency_us, jv_imu_plan_t *plan)
+{
+    uint64_t best = UINT64_MAX;
+    int8_t odr = matched_odr(rate_hz);
+    uint32_t rate_x10 = rate_hz * 10;
+
+    if (rate_hz == 0)
+        return -1;
+
+    /* power-cycle: IMU on for the warm-up, MCU for wake, SPI and TX */
+    uint32_t period_us = 1000000 / rate_hz;
+    uint32_t latency = 10000000 / odr_table[CYCLE_ODR].hz_x10;
+    if (JV_IMU_POLICY_CYCLE_ON_US + JV_IMU_POLICY_READ_US < period_us && latency <= max_latency_us)
+    {
+        uint64_t na = (uint64_t)JV_IMU_POLICY_PD_UA * 1000;
+        na += charge_na((uint64_t)(odr_table[CYCLE_ODR].ua - JV_IMU_POLICY_PD_UA) * JV_IMU_POLICY_CYCLE_ON_US, rate_x10);
+        na += charge_na((uint64_t)JV_IMU_POLICY_MCU_UA * (JV_IMU_POLICY_WAKE_US + JV_IMU_POLICY_READ_US + 2 * JV_IMU_POLICY_ODR_WRITE_US + JV_IMU_POLICY_TX_US), rate_x10);
+        best = na;
+        plan->mode = JV_IMU_MODE_POWER_CYCLE;
+        plan->odr = CYCLE_ODR;
+        plan->batch = 1;
+        plan->wake_period_us = period_us;
+        plan->packet_rate_x10 = rate_x10;
+        plan->latency_us = latency;
+    }
+
+    if (odr < 0)
+        return best == UINT64_MAX ? -1 : 0;
+
+    /* matched ODR: IMU always on, one read per packet, the lowest ODR within the latency */
+    for (uint8_t i = (uint8_t)odr; i < ODR_COUNT; i++)
+    {
+        latency = 10000000 / odr_table[i].hz_x10;
+        if (latency > max_latency_us)
+            continue;
+
+        uint64_t na = (uint64_t)odr_table[i].ua * 1000;
+        na += charge_na((uint64_t)JV_IMU_POLICY_MCU_UA * (JV_IMU_POLICY_WAKE_US + JV_IMU_POLICY_READ_US + JV_IMU_POLICY_TX_US), rate_x10);
+        if (na < best)
+        {
+            best = na;
+            plan->mode = JV_IMU_MODE_MATCHED_ODR;
+            plan->odr = i;
+            plan->batch = 1;
+            plan->wake_period_us = period_us;
+            plan->packet_rate_x10 = rate_x10;
+            plan->latency_us = latency;
+        }
+        break;
+    }
+
+#if JV_IMU_POLICY_FIFO
+    /* FIFO: the largest batch within the latency, every sample at the ODR is sent two per
+       packet, so the ODR must be at least twice the rate */
+    odr = matched_odr(2 * rate_hz);
+    uint32_t odr_x10 = odr < 0 ? 0 : odr_table[odr].hz_x10;
+    for (uint16_t batch = JV_IMU_POLICY_MAX_BATCH; batch >= 2 && odr >= 0; batch--)
+    {
+        latency = (uint32_t)((uint64_t)batch * 10000000 / odr_x10);
+        if (latency > max_latency_us)
+            continue;
+
+        uint64_t na = (uint64_t)odr_table[odr].ua * 1000;
+        na += charge_na((uint64_t)JV_IMU_POLICY_MCU_UA * (JV_IMU_POLICY_WAKE_US + 2 * batch * JV_IMU_POLICY_FIFO_WORD_US), odr_x10 / batch);
+        na += charge_na((uint64_t)JV_IMU_POLICY_MCU_UA * JV_IMU_POLICY_TX_US, odr_x10 / 2);
+        if (na < best)
+        {
+            best = na;
+            plan->mode = JV_IMU_MODE_FIFO_BATCH;
+            plan->odr = (uint8_t)odr;
+            plan->batch = batch;
+            plan->wake_period_us = latency;
+            plan->packet_rate_x10 = odr_x10 / 2;
+            plan->latency_us = latency;
+        }
+        break;
+    }
+#endif
+
+    if (best == UINT64_MAX)
+        return -1;
+    plan->current_na = best > UINT32_MAX ? UINT32_MAX : (uint32_t)best;
+    return 0;
+}
+
+int32_t jv_imu_policy_apply(stmdev_ctx_t *dev_ctx, const jv_imu_plan_t *plan)
+{
+    static bool interrupt_ready = false;
+    int32_t result = 0;
+    const imu_odr_t *odr = &odr_table[plan->odr];
+    lsm6dso32_pin_int1_route_t int1_ctrl = {0};
+    lsm6dso32_pin_int2_route_t int2_ctrl = {0};
+
+    imu_interrupt_disable();
+    result |= lsm6dso32_fifo_mode_set(dev_ctx, LSM6DSO32_BYPASS_MODE);               // empty and stop the FIFO
+    result |= lsm6dso32_fifo_xl_batch_set(dev_ctx, LSM6DSO32_XL_NOT_BATCHED);        //
+    result |= lsm6dso32_fifo_gy_batch_set(dev_ctx, LSM6DSO32_GY_NOT_BATCHED);        //
+
+    switch (plan->mode)
+    {
+    case JV_IMU_MODE_POWER_CYCLE:
+        int1_ctrl.int1_ctrl.int1_drdy_xl = PROPERTY_ENABLE;                           // xl data ready on int1
+        int2_ctrl.int2_ctrl.int2_drdy_g = PROPERTY_ENABLE;                            // g data ready on int2
+        result |= lsm6dso32_data_ready_mode_set(dev_ctx, LSM6DSO32_DRDY_PULSED);      //
+        result |= lsm6dso32_pin_int1_route_set(dev_ctx, &int1_ctrl);                  //
+        result |= lsm6dso32_pin_int2_route_set(dev_ctx, &int2_ctrl);                  //
+        result |= lsm6dso32_xl_data_rate_set(dev_ctx, LSM6DSO32_XL_ODR_OFF);          // off until the next read
+        result |= lsm6dso32_gy_data_rate_set(dev_ctx, LSM6DSO32_GY_ODR_OFF);          //
+        if (!interrupt_ready)
+        {
+            imu_interrupt_init();
+            interrupt_ready = true;
+        }
+        imu_interrupt_disable();
+        break;
+
+    case JV_IMU_MODE_FIFO_BATCH:
+        result |= lsm6dso32_pin_int1_route_set(dev_ctx, &int1_ctrl);                  // no DRDY
+        result |= lsm6dso32_pin_int2_route_set(dev_ctx, &int2_ctrl);                  //
+        result |= lsm6dso32_fifo_watermark_set(dev_ctx, 2 * plan->batch);             // xl + g word per sample
+        result |= lsm6dso32_fifo_xl_batch_set(dev_ctx, odr->xl_bdr);                  //
+        result |= lsm6dso32_fifo_gy_batch_set(dev_ctx, odr->gy_bdr);                  //
+        result |= lsm6dso32_fifo_mode_set(dev_ctx, LSM6DSO32_STREAM_MODE);            //
+        result |= lsm6dso32_xl_data_rate_set(dev_ctx, odr->xl);                       //
+        result |= lsm6dso32_gy_data_rate_set(dev_ctx, odr->gy);                       //
+        break;
+
+    case JV_IMU_MODE_MATCHED_ODR:
+    default:
+        result |= lsm6dso32_pin_int1_route_set(dev_ctx, &int1_ctrl);                  // no DRDY
+        result |= lsm6dso32_pin_int2_route_set(dev_ctx, &int2_ctrl);                  //
+        result |= lsm6dso32_xl_data_rate_set(dev_ctx, odr->xl);                       //
+        result |= lsm6dso32_gy_data_rate_set(dev_ctx, odr->gy);                       //
+        break;
+    }
+    return result;
+}
+
+int32_t jv_imu_policy_read(stmdev_ctx_t *dev_ctx, const jv_imu_plan_t *plan, uint16_t *buf)
+{
+    int32_t result = 0;
+
+    if (plan->mode != JV_IMU_MODE_POWER_CYCLE)
+        return imu_get_packet_data(dev_ctx, buf);
+
+    data_ready = 0;
+    imu_interrupt_enable();
+    result |= lsm6dso32_xl_data_rate_set(dev_ctx, odr_table[CYCLE_ODR].xl); // power up
+    result |= lsm6dso32_gy_data_rate_set(dev_ctx, odr_table[CYCLE_ODR].gy); //
+    while (data_ready != 1 && result == 0)
+    {
+        __WFE();
+    }
+    imu_interrupt_disable();
+    result |= imu_get_packet_data(dev_ctx, buf);
+    result |= lsm6dso32_xl_data_rate_set(dev_ctx, LSM6DSO32_XL_ODR_OFF);     // power down
+    result |= lsm6dso32_gy_data_rate_set(dev_ctx, LSM6DSO32_GY_ODR_OFF);     //
+    return result;
+}
+
+uint32_t jv_imu_policy_odr_hz(const jv_imu_plan_t *plan)
+{
+    return odr_table[plan->odr].hz_x10 / 10;
+}
@@ -0,0 +1,132 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_imu_policy.h
+ * @brief Runtime choice of the IMU power mode and ODR for a packet rate
+ * @date 2023-03-24
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * For a target rate jv_imu_policy_plan() models the average current of each
+ * way to get one fresh sample per packet and keeps the cheapest one within the
+ * latency limit:
+ *
+ *     POWER_CYCLE  power down between packets, wake at the fastest ODR for one sample
+ *     MATCHED_ODR  run at the lowest ODR at or above the rate, read once per packet
+ *     FIFO_BATCH   run at the lowest ODR at or above twice the rate into the FIFO, wake
+ *                  once per batch, two samples per packet
+ *
+ * FIFO_BATCH sends every sample, so its packet rate is ODR / 2, between the
+ * target rate and twice that, or 6.25 Hz at the lowest ODR. packet_rate_x10 in
+ * the plan is the rate that actually goes out. Define JV_IMU_POLICY_FIFO to 0
+ * where each packet carries a single sample.
+ *
+ * The model charges the IMU current of each mode, the MCU time spent on SPI and
+ * per wake, and the MCU time during each backscatter packet. The JV_IMU_POLICY_*
+ * constants are datasheet typicals and bench numbers, override them in main.h.
+ * jv_imu_policy_apply() then reconfigures the sensor, so the rate can change at
+ * runtime.
+ *
+ */
+
+#ifndef INC_JV_IMU_POLICY_H_
+#define INC_JV_IMU_POLICY_H_
+
+#include "jv_imu.h"
+
+#ifndef JV_IMU_POLICY_PD_UA
+#define JV_IMU_POLICY_PD_UA 3 // IMU power-down
+#endif
+#ifndef JV_IMU_POLICY_CYCLE_ON_US
+#define JV_IMU_POLICY_CYCLE_ON_US 2500 // power-on to the first DRDY at 6667 Hz
+#endif
+#ifndef JV_IMU_POLICY_MCU_UA
+#define JV_IMU_POLICY_MCU_UA 3000 // MCU running at 32 MHz
+#endif
+#ifndef JV_IMU_POLICY_WAKE_US
+#define JV_IMU_POLICY_WAKE_US 100 // DEEPSTOP exit and re-init
+#endif
+#ifndef JV_IMU_POLICY_TX_US
+#define JV_IMU_POLICY_TX_US 400 // one backscatter packet
+#endif
+#ifndef JV_IMU_POLICY_READ_US
+#define JV_IMU_POLICY_READ_US 40 // imu_get_packet_data()
+#endif
+#ifndef JV_IMU_POLICY_ODR_WRITE_US
+#define JV_IMU_POLICY_ODR_WRITE_US 10 // one ODR register write
+#endif
+#ifndef JV_IMU_POLICY_FIFO_WORD_US
+#define JV_IMU_POLICY_FIFO_WORD_US 10 // one FIFO word
+#endif
+#ifndef JV_IMU_POLICY_MAX_BATCH
+#define JV_IMU_POLICY_MAX_BATCH 8 // samples per FIFO wake
+#endif
+#ifndef JV_IMU_POLICY_FIFO
+#define JV_IMU_POLICY_FIFO 1 // FIFO_BATCH is a candidate
+#endif
+
+typedef enum
+{
+    JV_IMU_MODE_POWER_CYCLE,
+    JV_IMU_MODE_MATCHED_ODR,
+    JV_IMU_MODE_FIFO_BATCH,
+} jv_imu_mode_t;
+
+typedef struct
+{
+    jv_imu_mode_t mode;
+    uint8_t odr;             // index into the ODR table
+    uint16_t batch;          // samples per wake, 1 unless FIFO_BATCH
+    uint32_t wake_period_us; // for RTC_Scheduler_SetPeriodUS()
+    uint32_t packet_rate_x10; // packets per second x10, at least the target rate
+    uint32_t current_na;     // modelled average current
+    uint32_t latency_us;     // modelled worst sample age at TX
+} jv_imu_plan_t;
+
+/**
+ * @brief Pick the cheapest IMU mode for a packet rate
+ *
+ * @param rate_hz Target packet rate, the lowest rate any chosen mode sends at
+ * @param max_latency_us Maximum sample age at TX
+ * @param plan Chosen mode, ODR, batch size and wake period
+ * @return int32_t 0 if successful, -1 if no mode meets the latency or rate
+ */
+int32_t jv_imu_policy_plan(uint32_t rate_hz, uint32_t max_latency_us, jv_imu_plan_t *plan);
+
+/**
+ * @brief Reconfigure ODR, FIFO and DRDY routing for a plan
+ *
+ * Call after imu_init(). POWER_CYCLE also sets up the DRDY interrupt.
+ *
+ * @param dev_ctx Device handle
+ * @param plan Plan from jv_imu_policy_plan()
+ * @return int32_t 0 if successful, else -1
+ */
+int32_t jv_imu_policy_apply(stmdev_ctx_t *dev_ctx, const jv_imu_plan_t *plan);
+
+/**
+ * @brief Read one sample in the POWER_CYCLE or MATCHED_ODR mode
+ *
+ * POWER_CYCLE powers the IMU up, sleeps until its DRDY and powers it down
+ * again. FIFO_BATCH uses imu_fifo_read() instead.
+ *
+ * @param dev_ctx Device handle
+ * @param plan Applied plan
+ * @param buf Buffer to store 18 bytes of IMU data, see imu_get_packet_data()
+ * @return int32_t 0 if successful, else -1
+ */
+int32_t jv_imu_policy_read(stmdev_ctx_t *dev_ctx, const jv_imu_plan_t *plan, uint16_t *buf);
+
+/**
+ * @brief Output data rate of a plan
+ *
+ * @param plan Plan from jv_imu_policy_plan()
+ * @return uint32_t ODR in Hz, rounded down
+ */
+uint32_t jv_imu_policy_odr_hz(const jv_imu_plan_t *plan);
+
+#endif /* INC_JV_IMU_POLICY_H_ */
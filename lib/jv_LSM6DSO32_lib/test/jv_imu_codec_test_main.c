@@ -0,0 +1,142 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_imu_codec_test_main.c
+ * @brief Host round trip test and reference decoder for the IMU payload codec
+ * @date 2023-03-20
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Build and run on the host from lib/jv_LSM6DSO32_lib:
+ *
+ *     gcc -O2 -o jv_imu_codec_test test/jv_imu_codec_test_main.c jv_imu_codec.c -lm
+ *     ./jv_imu_codec_test
+ *
+ * Each stream is split into packets the way the endpoint does it, every packet
+ * is decoded on its own and compared with the input. Prints the average
+ * samples per packet and returns non-zero on a mismatch.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../jv_imu_codec.h"
+
+#define STREAM_LEN  2000
+#define PAYLOAD_LEN 28 // 31 byte AdvData after link ID and sequence number
+
+typedef void (*generator_t)(jv_imu_sample_t *s, uint32_t n);
+
+static int16_t noise(int amplitude)
+{
+    return (int16_t)(rand() % (2 * amplitude + 1) - amplitude);
+}
+
+/* resting on a table: constant gravity on z, a few LSB of noise */
+static void gen_still(jv_imu_sample_t *s, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        s[i].timestamp = (uint16_t)(1000 + i * 96 + noise(1)); // 417 Hz in 25 us ticks, wraps
+        for (int a = 0; a < 3; a++)
+        {
+            s[i].gyro[a] = noise(3);
+            s[i].accel[a] = (a == 2 ? 8196 : 0) + noise(4);
+        }
+    }
+}
+
+/* slow rotation, FIFO sample index as the timestamp */
+static void gen_motion(jv_imu_sample_t *s, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        double t = i / 417.0;
+        s[i].timestamp = (uint16_t)i;
+        for (int a = 0; a < 3; a++)
+        {
+            s[i].gyro[a] = (int16_t)(3000 * sin(2 * M_PI * (0.5 + a) * t)) + noise(3);
+            s[i].accel[a] = (int16_t)(8000 * cos(2 * M_PI * 0.3 * t + a)) + noise(4);
+        }
+    }
+}
+
+/* full scale jumps, timestamp wrap and a timestamp going backwards */
+static void gen_extreme(jv_imu_sample_t *s, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        s[i].timestamp = (uint16_t)(0xF000 + i * 333);
+        if (i % 97 == 50)
+            s[i].timestamp -= 5000;
+        for (int a = 0; a < 3; a++)
+        {
+            s[i].gyro[a] = (i & 1) ? INT16_MAX : INT16_MIN;
+            s[i].accel[a] = (int16_t)rand();
+        }
+    }
+}
+
+static int same(const jv_imu_sample_t *a, const jv_imu_sample_t *b)
+{
+    if (a->timestamp != b->timestamp)
+        return 0;
+    return memcmp(a->gyro, b->gyro, sizeof(a->gyro)) == 0 && memcmp(a->accel, b->accel, sizeof(a->accel)) == 0;
+}
+
+static int run(const char *name, generator_t gen)
+{
+    static jv_imu_sample_t in[STREAM_LEN];
+    jv_imu_sample_t out[JV_IMU_CODEC_MAX_SAMPLES];
+    uint8_t payload[PAYLOAD_LEN];
+    uint32_t packets = 0, errors = 0;
+
+    gen(in, STREAM_LEN);
+    for (uint32_t sent = 0; sent < STREAM_LEN;)
+    {
+        uint8_t n_encoded;
+        size_t len = jv_imu_codec_encode(payload, sizeof(payload), &in[sent], STREAM_LEN - sent, &n_encoded);
+        if (len == 0 || len > sizeof(payload) || n_encoded == 0)
+        {
+            printf("  %s: encode failed at sample %u\n", name, sent);
+            return 1;
+        }
+
+        uint8_t n_decoded = jv_imu_codec_decode(payload, sizeof(payload), out);
+        if (n_decoded != n_encoded)
+            errors++;
+        for (uint8_t i = 0; i < n_decoded && i < n_encoded; i++)
+        {
+            if (!same(&in[sent + i], &out[i]))
+                errors++;
+        }
+        if (len > 1 && jv_imu_codec_decode(payload, len - 1, out) != 0)
+            errors++; // truncated payload must be rejected
+
+        sent += n_encoded;
+        packets++;
+    }
+
+    printf("%-8s %5u samples %5u packets %5.2f samples/packet  %s\n",
+           name, STREAM_LEN, packets, (double)STREAM_LEN / packets, errors ? "FAIL" : "PASS");
+    return errors != 0;
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    int failed = 0;
+
+    srand(1);
+    failed |= run("still", gen_still);
+    failed |= run("motion", gen_motion);
+    failed |= run("extreme", gen_extreme);
+
+    return failed;
+}
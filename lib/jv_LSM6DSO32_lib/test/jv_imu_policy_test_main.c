@@ -0,0 +1,281 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_imu_policy_test_main.c
+ * @brief Host test of the IMU policy plan
+ * @date 2023-03-24
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Build and run on the host from lib/jv_LSM6DSO32_lib:
+ *
+ *     gcc -O2 -o jv_imu_policy_test test/jv_imu_policy_test_main.c
+ *     ./jv_imu_policy_test
+ *
+ * The policy is compiled into this file against stubs of the sensor driver,
+ * only jv_imu_policy_plan() is exercised. Every plan over a sweep of rates and
+ * latency limits must meet both, a few picks are checked against the model by
+ * hand. Returns non-zero on a failure.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* jv_imu.h pulls in the SDK, stub the part the policy uses instead */
+#define INC_IMU_H_
+
+typedef struct
+{
+    void *handle;
+} stmdev_ctx_t;
+
+typedef int lsm6dso32_odr_xl_t;
+typedef int lsm6dso32_odr_g_t;
+typedef int lsm6dso32_bdr_xl_t;
+typedef int lsm6dso32_bdr_gy_t;
+
+typedef struct
+{
+    struct
+    {
+        uint8_t int1_drdy_xl;
+    } int1_ctrl;
+} lsm6dso32_pin_int1_route_t;
+
+typedef struct
+{
+    struct
+    {
+        uint8_t int2_drdy_g;
+    } int2_ctrl;
+} lsm6dso32_pin_int2_route_t;
+
+enum
+{
+    LSM6DSO32_XL_ODR_OFF,
+    LSM6DSO32_XL_ODR_12Hz5_LOW_PW,
+    LSM6DSO32_XL_ODR_26Hz_LOW_PW,
+    LSM6DSO32_XL_ODR_52Hz_LOW_PW,
+    LSM6DSO32_XL_ODR_104Hz_NORMAL_MD,
+    LSM6DSO32_XL_ODR_208Hz_NORMAL_MD,
+    LSM6DSO32_XL_ODR_417Hz_HIGH_PERF,
+    LSM6DSO32_XL_ODR_833Hz_HIGH_PERF,
+    LSM6DSO32_XL_ODR_1667Hz_HIGH_PERF,
+    LSM6DSO32_XL_ODR_3333Hz_HIGH_PERF,
+    LSM6DSO32_XL_ODR_6667Hz_HIGH_PERF,
+};
+enum
+{
+    LSM6DSO32_GY_ODR_OFF,
+    LSM6DSO32_GY_ODR_12Hz5_LOW_PW,
+    LSM6DSO32_GY_ODR_26Hz_LOW_PW,
+    LSM6DSO32_GY_ODR_52Hz_LOW_PW,
+    LSM6DSO32_GY_ODR_104Hz_NORMAL_MD,
+    LSM6DSO32_GY_ODR_208Hz_NORMAL_MD,
+    LSM6DSO32_GY_ODR_417Hz_HIGH_PERF,
+    LSM6DSO32_GY_ODR_833Hz_HIGH_PERF,
+    LSM6DSO32_GY_ODR_1667Hz_HIGH_PERF,
+    LSM6DSO32_GY_ODR_3333Hz_HIGH_PERF,
+    LSM6DSO32_GY_ODR_6667Hz_HIGH_PERF,
+};
+enum
+{
+    LSM6DSO32_XL_NOT_BATCHED,
+    LSM6DSO32_XL_BATCHED_AT_12Hz5,
+    LSM6DSO32_XL_BATCHED_AT_26Hz,
+    LSM6DSO32_XL_BATCHED_AT_52Hz,
+    LSM6DSO32_XL_BATCHED_AT_104Hz,
+    LSM6DSO32_XL_BATCHED_AT_208Hz,
+    LSM6DSO32_XL_BATCHED_AT_417Hz,
+    LSM6DSO32_XL_BATCHED_AT_833Hz,
+    LSM6DSO32_XL_BATCHED_AT_1667Hz,
+    LSM6DSO32_XL_BATCHED_AT_3333Hz,
+    LSM6DSO32_XL_BATCHED_AT_6667Hz,
+};
+enum
+{
+    LSM6DSO32_GY_NOT_BATCHED,
+    LSM6DSO32_GY_BATCHED_AT_12Hz5,
+    LSM6DSO32_GY_BATCHED_AT_26Hz,
+    LSM6DSO32_GY_BATCHED_AT_52Hz,
+    LSM6DSO32_GY_BATCHED_AT_104Hz,
+    LSM6DSO32_GY_BATCHED_AT_208Hz,
+    LSM6DSO32_GY_BATCHED_AT_417Hz,
+    LSM6DSO32_GY_BATCHED_AT_833Hz,
+    LSM6DSO32_GY_BATCHED_AT_1667Hz,
+    LSM6DSO32_GY_BATCHED_AT_3333Hz,
+    LSM6DSO32_GY_BATCHED_AT_6667Hz,
+};
+enum
+{
+    LSM6DSO32_BYPASS_MODE,
+    LSM6DSO32_STREAM_MODE,
+    LSM6DSO32_DRDY_PULSED,
+    PROPERTY_ENABLE,
+};
+
+static int32_t stub_set(stmdev_ctx_t *ctx, int val)
+{
+    (void)ctx;
+    (void)val;
+    return 0;
+}
+
+static int32_t lsm6dso32_pin_int1_route_set(stmdev_ctx_t *ctx, lsm6dso32_pin_int1_route_t *val)
+{
+    (void)ctx;
+    (void)val;
+    return 0;
+}
+
+static int32_t lsm6dso32_pin_int2_route_set(stmdev_ctx_t *ctx, lsm6dso32_pin_int2_route_t *val)
+{
+    (void)ctx;
+    (void)val;
+    return 0;
+}
+
+#define lsm6dso32_fifo_mode_set       stub_set
+#define lsm6dso32_fifo_xl_batch_set   stub_set
+#define lsm6dso32_fifo_gy_batch_set   stub_set
+#define lsm6dso32_fifo_watermark_set  stub_set
+#define lsm6dso32_data_ready_mode_set stub_set
+#define lsm6dso32_xl_data_rate_set    stub_set
+#define lsm6dso32_gy_data_rate_set    stub_set
+
+static void imu_interrupt_init(void) {}
+static void imu_interrupt_enable(void) {}
+static void imu_interrupt_disable(void) {}
+static void __WFE(void) {}
+
+static int32_t imu_get_packet_data(stmdev_ctx_t *ctx, uint16_t *buf)
+{
+    (void)ctx;
+    (void)buf;
+    return 0;
+}
+
+volatile uint8_t data_ready;
+
+#include "../jv_imu_policy.c"
+
+static const char *mode_name[] = {"POWER_CYCLE", "MATCHED_ODR", "FIFO_BATCH"};
+
+/* every plan meets the rate and the latency limit, with the ODR its mode needs */
+static int check_plan(uint32_t rate_hz, uint32_t max_latency_us, const jv_imu_plan_t *plan)
+{
+    uint32_t odr_x10 = odr_table[plan->odr].hz_x10;
+
+    if (plan->latency_us > max_latency_us || plan->packet_rate_x10 < rate_hz * 10)
+        return 1;
+    switch (plan->mode)
+    {
+    case JV_IMU_MODE_POWER_CYCLE:
+        return plan->odr != CYCLE_ODR || plan->batch != 1 || plan->wake_period_us != 1000000 / rate_hz ||
+               JV_IMU_POLICY_CYCLE_ON_US + JV_IMU_POLICY_READ_US >= plan->wake_period_us;
+    case JV_IMU_MODE_MATCHED_ODR:
+        return odr_x10 < rate_hz * 10 || plan->batch != 1 || plan->wake_period_us != 1000000 / rate_hz;
+    case JV_IMU_MODE_FIFO_BATCH:
+        return odr_x10 < 2 * rate_hz * 10 || plan->packet_rate_x10 != odr_x10 / 2 || plan->batch < 2 ||
+               plan->batch > JV_IMU_POLICY_MAX_BATCH || plan->wake_period_us != plan->latency_us ||
+               (plan->odr > 0 && odr_table[plan->odr - 1].hz_x10 >= 2 * rate_hz * 10);
+    default:
+        return 1;
+    }
+}
+
+static int sweep(void)
+{
+    static const uint32_t latencies[] = {1000, 5000, 20000, 100000, 1000000};
+    uint32_t plans = 0, none = 0, errors = 0, modes[3] = {0};
+
+    for (uint32_t l = 0; l < sizeof(latencies) / sizeof(latencies[0]); l++)
+    {
+        for (uint32_t rate = 1; rate <= 7000; rate++)
+        {
+            jv_imu_plan_t plan;
+            if (jv_imu_policy_plan(rate, latencies[l], &plan) != 0)
+            {
+                none++;
+                continue;
+            }
+            plans++;
+            modes[plan.mode]++;
+            if (check_plan(rate, latencies[l], &plan))
+            {
+                if (errors++ < 10)
+                    printf("  %u Hz %u us: %s ODR %u batch %u packets %u.%u/s latency %u us\n",
+                           rate, latencies[l], mode_name[plan.mode], odr_table[plan.odr].hz_x10 / 10,
+                           plan.batch, plan.packet_rate_x10 / 10, plan.packet_rate_x10 % 10, plan.latency_us);
+            }
+        }
+    }
+
+    printf("sweep    %6u plans %5u none  %5u power cycle %5u matched %5u FIFO  %s\n",
+           plans, none, modes[JV_IMU_MODE_POWER_CYCLE], modes[JV_IMU_MODE_MATCHED_ODR], modes[JV_IMU_MODE_FIFO_BATCH],
+           errors ? "FAIL" : "PASS");
+    return errors != 0;
+}
+
+typedef struct
+{
+    uint32_t rate_hz;
+    uint32_t max_latency_us;
+    int32_t result;
+    jv_imu_mode_t mode;
+    uint32_t odr_hz;
+    uint16_t batch;
+} pick_t;
+
+/* worked through the model with the default constants */
+static const pick_t picks[] = {
+    {0, 20000, -1, 0, 0, 0},                              // no rate
+    {1, 20000, 0, JV_IMU_MODE_POWER_CYCLE, 6667, 1},      // ~6 uA, against 170 uA for any ODR left on
+    {40, 25000, 0, JV_IMU_MODE_POWER_CYCLE, 6667, 1},     // the EP-DL-BT+ uplink at 40 Hz
+    {100, 20000, 0, JV_IMU_MODE_POWER_CYCLE, 6667, 1},    // 314 uA, a 208 Hz FIFO for 104 packets/s is 603 uA
+    {400, 20000, 0, JV_IMU_MODE_FIFO_BATCH, 833, 8},      // 416 packets/s, not the 208 of a 417 Hz FIFO
+    {400, 1000, 0, JV_IMU_MODE_MATCHED_ODR, 1667, 1},     // 417 and 833 Hz samples are too old
+    {7000, 1000000, -1, 0, 0, 0},                         // above the fastest ODR
+};
+
+static int check_picks(void)
+{
+    uint32_t errors = 0;
+
+    for (uint32_t i = 0; i < sizeof(picks) / sizeof(picks[0]); i++)
+    {
+        const pick_t *p = &picks[i];
+        jv_imu_plan_t plan;
+        int32_t result = jv_imu_policy_plan(p->rate_hz, p->max_latency_us, &plan);
+
+        if (result != p->result ||
+            (result == 0 && (plan.mode != p->mode || jv_imu_policy_odr_hz(&plan) != p->odr_hz || plan.batch != p->batch)))
+        {
+            errors++;
+            printf("  %u Hz %u us: got %d", p->rate_hz, p->max_latency_us, result);
+            if (result == 0)
+                printf(" %s ODR %u batch %u", mode_name[plan.mode], jv_imu_policy_odr_hz(&plan), plan.batch);
+            printf("\n");
+        }
+    }
+
+    printf("picks    %6u cases  %s\n", (unsigned)(sizeof(picks) / sizeof(picks[0])), errors ? "FAIL" : "PASS");
+    return errors != 0;
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    int failed = 0;
+
+    failed |= sweep();
+    failed |= check_picks();
+
+    return failed;
+}
@@ -22,93 +22,32 @@
 #define BLE_OFFSET 35
 #endif
 
-#if BLE_OFFSET == -15
-/* -1.5 MHz offset */
-/*                                      Even  Odd  */
-#define ZERO_ENCODING_1Mbps  CONCAT(0x, 00ff, 00ff)
-#define ONE_ENCODING_1Mbps   CONCAT(0x, f0f0, 00ff)
-#define TWO_ENCODING_1Mbps   CONCAT(0X, 00ff, f0f0)
-#define THREE_ENCODING_1Mbps CONCAT(0X, f0f0, f0f0)
+/* Row of offset_lookup_1Mbps for an offset in 100 kHz, -1 if there is none */
+#define OFFSET_INDEX_1Mbps(o) ((o) == -15 ? 0 : (o) == -30 ? 1 : (o) == -35 ? 2 : (o) == -40 ? 3 : (o) == -45 ? 4 : \
+                               (o) == 15 ? 5 : (o) == 30 ? 6 : (o) == 35 ? 7 : (o) == 40 ? 8 : (o) == 45 ? 9 : -1)
 
-#elif BLE_OFFSET == -30
-/* -3 MHz offset */
-/*                                      Even  Odd  */
-#define ZERO_ENCODING_1Mbps  CONCAT(0x, 711c, 8ee3)
-#define ONE_ENCODING_1Mbps   CONCAT(0x, 9831, 8ee3)
-#define TWO_ENCODING_1Mbps   CONCAT(0X, 711c, 67ce)
-#define THREE_ENCODING_1Mbps CONCAT(0X, 9831, 67ce)
-
-#elif BLE_OFFSET == -35
-/* -3.5 MHz offset */
-/*                                      Even  Odd  */
-#define ZERO_ENCODING_1Mbps  CONCAT(0x, 38E7, 38E7)
-#define ONE_ENCODING_1Mbps   CONCAT(0x, CCCC, 38E7)
-#define TWO_ENCODING_1Mbps   CONCAT(0X, 38E7, CCCC)
-#define THREE_ENCODING_1Mbps CONCAT(0X, CCCC, CCCC)
-
-#elif BLE_OFFSET == -40
-/* -4 MHz offset */
-/*                                      Even  Odd  */
-#define ZERO_ENCODING_1Mbps  CONCAT(0x, 9831, 67ce)
-#define ONE_ENCODING_1Mbps   CONCAT(0x, 6c26, 67ce)
-#define TWO_ENCODING_1Mbps   CONCAT(0X, 9831, 93d9)
-#define THREE_ENCODING_1Mbps CONCAT(0X, 6c26, 93d9)
-
-#elif BLE_OFFSET == -45
-/* -4.5 MHz offset */
-/*                                      Even  Odd  */
-#define ZERO_ENCODING_1Mbps  CONCAT(0x, 3333, 3333)
-#define ONE_ENCODING_1Mbps   CONCAT(0x, db24, 3333)
-#define TWO_ENCODING_1Mbps   CONCAT(0X, 3333, db24)
-#define THREE_ENCODING_1Mbps CONCAT(0X, db24, db24)
-
-/**************************************************/
-/**************** Positive offsets ****************/
-/**************************************************/
-
-#elif BLE_OFFSET == 15
-/* 1.5 MHz offset */
-/*                                      Even  Odd  */
-#define THREE_ENCODING_1Mbps CONCAT(0x, 00ff, 00ff)
-#define TWO_ENCODING_1Mbps   CONCAT(0x, f0f0, 00ff)
-#define ONE_ENCODING_1Mbps   CONCAT(0X, 00ff, f0f0)
-#define ZERO_ENCODING_1Mbps  CONCAT(0X, f0f0, f0f0)
-
-#elif BLE_OFFSET == 30
-/* 3 MHz offset */
-/*                                      Even  Odd  */
-#define THREE_ENCODING_1Mbps CONCAT(0x, 711c, 8ee3)
-#define TWO_ENCODING_1Mbps   CONCAT(0x, 9831, 8ee3)
-#define ONE_ENCODING_1Mbps   CONCAT(0X, 711c, 67ce)
-#define ZERO_ENCODING_1Mbps  CONCAT(0X, 9831, 67ce)
-
-#elif BLE_OFFSET == 35
-/* 3.5 MHz offset */
-/*                                      Even  Odd  */
-#define THREE_ENCODING_1Mbps CONCAT(0x, 38E7, 38E7)
-#define TWO_ENCODING_1Mbps   CONCAT(0x, CCCC, 38E7)
-#define ONE_ENCODING_1Mbps   CONCAT(0X, 38E7, CCCC)
-#define ZERO_ENCODING_1Mbps  CONCAT(0X, CCCC, CCCC)
-
-#elif BLE_OFFSET == 40
-/* 4 MHz offset */
-/*                                      Even  Odd  */
-#define THREE_ENCODING_1Mbps CONCAT(0x, 9831, 67ce)
-#define TWO_ENCODING_1Mbps   CONCAT(0x, 6c26, 67ce)
-#define ONE_ENCODING_1Mbps   CONCAT(0X, 9831, 93d9)
-#define ZERO_ENCODING_1Mbps  CONCAT(0X, 6c26, 93d9)
-
-#elif BLE_OFFSET == 45
-/* 4.5 MHz offset */
-/*                                      Even  Odd  */
-#define THREE_ENCODING_1Mbps CONCAT(0x, 3333, 3333)
-#define TWO_ENCODING_1Mbps   CONCAT(0x, db24, 3333)
-#define ONE_ENCODING_1Mbps   CONCAT(0X, 3333, db24)
-#define ZERO_ENCODING_1Mbps  CONCAT(0X, db24, db24)
-#else
+#if OFFSET_INDEX_1Mbps(BLE_OFFSET) < 0
 #error "Invalid BLE_OFFSET"
 #endif
 
+/* 1 Mbps encodings of the bit pairs 00, 01, 10, 11, per offset.
+ * A positive offset uses the encodings of the negative one in reverse order.
+ *                                  Even  Odd               Even  Odd               Even  Odd               Even  Odd  */
+static const uint32_t offset_lookup_1Mbps[][4] = {
+    /* -1.5 MHz */ {CONCAT(0x, 00ff, 00ff), CONCAT(0x, f0f0, 00ff), CONCAT(0x, 00ff, f0f0), CONCAT(0x, f0f0, f0f0)},
+    /* -3 MHz   */ {CONCAT(0x, 711c, 8ee3), CONCAT(0x, 9831, 8ee3), CONCAT(0x, 711c, 67ce), CONCAT(0x, 9831, 67ce)},
+    /* -3.5 MHz */ {CONCAT(0x, 38E7, 38E7), CONCAT(0x, CCCC, 38E7), CONCAT(0x, 38E7, CCCC), CONCAT(0x, CCCC, CCCC)},
+    /* -4 MHz   */ {CONCAT(0x, 9831, 67ce), CONCAT(0x, 6c26, 67ce), CONCAT(0x, 9831, 93d9), CONCAT(0x, 6c26, 93d9)},
+    /* -4.5 MHz */ {CONCAT(0x, 3333, 3333), CONCAT(0x, db24, 3333), CONCAT(0x, 3333, db24), CONCAT(0x, db24, db24)},
+    /* 1.5 MHz  */ {CONCAT(0x, f0f0, f0f0), CONCAT(0x, 00ff, f0f0), CONCAT(0x, f0f0, 00ff), CONCAT(0x, 00ff, 00ff)},
+    /* 3 MHz    */ {CONCAT(0x, 9831, 67ce), CONCAT(0x, 711c, 67ce), CONCAT(0x, 9831, 8ee3), CONCAT(0x, 711c, 8ee3)},
+    /* 3.5 MHz  */ {CONCAT(0x, CCCC, CCCC), CONCAT(0x, 38E7, CCCC), CONCAT(0x, CCCC, 38E7), CONCAT(0x, 38E7, 38E7)},
+    /* 4 MHz    */ {CONCAT(0x, 6c26, 93d9), CONCAT(0x, 9831, 93d9), CONCAT(0x, 6c26, 67ce), CONCAT(0x, 9831, 67ce)},
+    /* 4.5 MHz  */ {CONCAT(0x, db24, db24), CONCAT(0x, 3333, db24), CONCAT(0x, db24, 3333), CONCAT(0x, 3333, 3333)},
+};
+
+static const uint32_t *upscale_lookup_1Mbps = offset_lookup_1Mbps[OFFSET_INDEX_1Mbps(BLE_OFFSET)];
+
 /* -3 MHz offset */
 /*                                         EvenOdd  */
 #define ZERO_ENCODING_2Mbps  CONCAT(0x, 0000, F0F0)
@@ -116,20 +55,25 @@
 #define TWO_ENCODING_2Mbps   CONCAT(0X, 0000, F0CC)
 #define THREE_ENCODING_2Mbps CONCAT(0X, 0000, CCCC)
 
-const uint32_t upscale_lookup_1Mbps[4] = {
-    ZERO_ENCODING_1Mbps,
-    ONE_ENCODING_1Mbps,
-    TWO_ENCODING_1Mbps,
-    THREE_ENCODING_1Mbps};
-
 const uint32_t upscale_lookup_2Mbps[4] = {
     ZERO_ENCODING_2Mbps,
     ONE_ENCODING_2Mbps,
     TWO_ENCODING_2Mbps,
     THREE_ENCODING_2Mbps};
 
+int jv_bsc_set_offset_1Mbps(int8_t offset)
+{
+    int index = OFFSET_INDEX_1Mbps(offset);
+
+    if (index < 0)
+        return -1;
+    upscale_lookup_1Mbps = offset_lookup_1Mbps[index];
+    return 0;
+}
+
 uint32_t jv_bsc_upscale_1Mbps(uint32_t *dst, uint8_t *packet, size_t packet_len)
 {
+    const uint32_t *lookup = upscale_lookup_1Mbps;
 
     /* We are writing 2 bytes per bit = 16 bytes per byte = 4 uint32s per byte
        So we stop after writing (4 * packet_len) uint32s
@@ -137,10 +81,10 @@ uint32_t jv_bsc_upscale_1Mbps(uint32_t *dst, uint8_t *packet, size_t packet_len)
     const uint32_t *stopping_point = dst + (packet_len << 2);
     while (dst < stopping_point)
     {
-        *(dst++) = upscale_lookup_1Mbps[(((*packet) & 0xc0) >> 6)];
-        *(dst++) = upscale_lookup_1Mbps[(((*packet) & 0x30) >> 4)];
-        *(dst++) = upscale_lookup_1Mbps[(((*packet) & 0x0c) >> 2)];
-        *(dst++) = upscale_lookup_1Mbps[((*packet) & 0x03)];
+        *(dst++) = lookup[(((*packet) & 0xc0) >> 6)];
+        *(dst++) = lookup[(((*packet) & 0x30) >> 4)];
+        *(dst++) = lookup[(((*packet) & 0x0c) >> 2)];
+        *(dst++) = lookup[((*packet) & 0x03)];
         packet++;
     }
     return packet_len << 4;
@@ -20,6 +20,17 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/**
+ * @brief Select the backscatter frequency offset used by jv_bsc_upscale_1Mbps()
+ *
+ * Starts at BLE_OFFSET. Takes effect from the next upscaled packet. The 2 Mbps
+ * upscale is always at -3 MHz.
+ *
+ * @param offset Offset in 100 kHz: -45, -40, -35, -30, -15, 15, 30, 35, 40 or 45
+ * @return int 0 on success, -1 if there is no encoding for offset
+ */
+int jv_bsc_set_offset_1Mbps(int8_t offset);
+
 /**
  * @brief Upscale a ble packet for backscatter at 1 Mbps phy
  *
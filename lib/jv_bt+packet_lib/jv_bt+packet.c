@@ -288,6 +288,26 @@ void update_advertising_packet(jv_ble_packet *packet, jv_ble_pdu *pdu)
     /* Whiten the packet */
     whiten(&(packet->whitened_packet[whitening_start]), packet->whitening_lookup_table, (packet->packet_len - whitening_start));
 }
+
+uint32_t packet_airtime_us(const jv_ble_packet *packet)
+{
+    uint32_t block_2_bits = (packet->packet_len - (CODED_PREAMBLE_SIZE + ACCESS_ADDRESS_SIZE)) * 8 + 3; // PDU, CRC, TERM2
+
+    switch (packet->encoding)
+    {
+    case UNCODED_1MBPS:
+        return packet->packet_len * 8;
+    case UNCODED_2MBPS:
+        return packet->packet_len * 4;
+    case CODED_S2:
+        return 80 + (ACCESS_ADDRESS_SIZE * 8 + 2 + 3) * 8 + block_2_bits * 2;
+    case CODED_S8:
+        return 80 + (ACCESS_ADDRESS_SIZE * 8 + 2 + 3) * 8 + block_2_bits * 8;
+    default:
+        return 0;
+    }
+}
+
 size_t encode_packet(uint8_t *dst, jv_ble_packet *packet)
 {
     // if (packet->encoding != CODED_S2 && packet->encoding != CODED_S8)
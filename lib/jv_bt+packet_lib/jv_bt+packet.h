@@ -112,4 +112,16 @@ void update_advertising_packet(jv_ble_packet *packet, jv_ble_pdu *pdu);
 
 size_t encode_packet(uint8_t *dst, jv_ble_packet *packet);
 
+/**
+ * @brief On-air time of a packet at its encoding
+ *
+ * Uncoded: every Byte of the whitened packet at 8 or 4 us. Coded: 80 us
+ * preamble, access address, CI and TERM1 at S8, then PDU, CRC and TERM2 at
+ * S2 or S8.
+ *
+ * @param packet Pointer to jv_ble_packet initalized from a successful call to init_packet()
+ * @return uint32_t Time from the first preamble bit to the last bit, in us
+ */
+uint32_t packet_airtime_us(const jv_ble_packet *packet);
+
 #endif
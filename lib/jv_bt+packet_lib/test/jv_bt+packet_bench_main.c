@@ -0,0 +1,357 @@
+/**
+ *       _                       __        ___          _
+ *      | | ___  _____   ____ _  \ \      / (_)_ __ ___| | ___  ___ ___
+ *   _  | |/ _ \/ _ \ \ / / _` |  \ \ /\ / /| | '__/ _ \ |/ _ \/ __/ __|
+ *  | |_| |  __/  __/\ V / (_| |   \ V  V / | | | |  __/ |  __/\__ \__ \
+ *   \___/ \___|\___| \_/ \__,_|    \_/\_/  |_|_|  \___|_|\___||___/___/
+ *
+ * @file jv_bt+packet_bench_main.c
+ * @brief Host benchmark and golden-output check for the BT+ encoding pipeline
+ * @date 2023-03-06
+ *
+ * @copyright Copyright (c) 2023 Jeeva Wireless
+ *
+ * Build and run on the host from lib/jv_bt+packet_lib:
+ *
+ *     gcc -O2 -o jv_bt+packet_bench test/jv_bt+packet_bench_main.c crc.c jv_bt+bsc.c
+ *     ./jv_bt+packet_bench [iterations]
+ *
+ * jv_bt+packet.c is included directly so the static whitening and FEC helpers
+ * can be timed on their own, so do not link it a second time.
+ *
+ * Every stage is hashed against a golden value captured from the reference
+ * implementation, and the airtime of an endpoint packet is checked for each
+ * encoding. Any optimization of the pipeline must keep all checks at
+ * PASS, i.e. stay bit-exact. The program returns non-zero on a mismatch.
+ *
+ * The M0+ cycle column is an estimate only: host time cannot be scaled to the
+ * target, so it is derived from hand-counted Thumb-1 cycles per input byte of
+ * each loop body (zero wait-state flash, 32 MHz). Use the on-target trace to
+ * get real numbers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../jv_bt+packet.c"
+#include "../jv_bt+bsc.h"
+
+#define DEFAULT_ITERATIONS 20000
+#define M0P_CLOCK_MHZ      32
+#define BENCH_BLE_CHANNEL  37
+#define EP_ADV_DATA_SIZE   24 // AdvData length the endpoints send
+
+/* Estimated Cortex-M0+ cycles per input byte, hand-counted from each loop body */
+#define M0P_CYCLES_CRC      24
+#define M0P_CYCLES_WHITEN   10
+#define M0P_CYCLES_PDU      14
+#define M0P_CYCLES_FEC_S2   130
+#define M0P_CYCLES_FEC_S8   120
+#define M0P_CYCLES_UPSCALE1 28
+#define M0P_CYCLES_UPSCALE2 26
+
+/* Golden FNV-1a hashes of each stage output, captured from the reference implementation */
+#define GOLDEN_CRC        0xcc3e730bu
+#define GOLDEN_WHITEN     0x086839fdu
+#define GOLDEN_PDU        0xa657147cu
+#define GOLDEN_ENCODE_S2  0xd2b15396u
+#define GOLDEN_ENCODE_S8  0xf23d44e5u
+#define GOLDEN_UPSCALE_1M 0x8dddb85du
+#define GOLDEN_UPSCALE_2M 0x0db7d355u
+
+static const uint32_t GOLDEN_PIPELINE[4] = {
+    0xc145a725u, /* UNCODED_1MBPS */
+    0x651f1e2du, /* UNCODED_2MBPS */
+    0xea07a6edu, /* CODED_S2 */
+    0x99e7ddc5u  /* CODED_S8 */
+};
+
+/* packet_airtime_us() of an endpoint packet, EP_ADV_DATA_SIZE Bytes of AdvData, in us */
+static const uint32_t GOLDEN_AIRTIME_US[4] = {
+    320,  /* UNCODED_1MBPS */
+    164,  /* UNCODED_2MBPS */
+    942,  /* CODED_S2 */
+    2640  /* CODED_S8 */
+};
+
+static const char *const encoding_name[4] = {"1M", "2M", "S2", "S8"};
+
+static uint8_t AdvA[ADVERTISING_ADDRESS_SIZE] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc};
+static uint8_t AdvData[MAX_ADVERTISING_DATA_SIZE];
+
+static uint8_t coded_buf[CODED_MAX_PACKET_SIZE * 2];
+static uint32_t upscaled_buf[CODED_MAX_PACKET_SIZE * 8];
+
+static volatile uint32_t sink;
+static int failures;
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len--)
+    {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void fill_payload(uint8_t len, uint8_t seed)
+{
+    for (uint8_t i = 0; i < len; i++)
+    {
+        AdvData[i] = (uint8_t)(i * 37u + seed);
+    }
+}
+
+static void report(const char *name, uint64_t elapsed_ns, uint32_t iterations, size_t bytes, uint32_t cycles_per_byte)
+{
+    double ns = (double)elapsed_ns / iterations;
+    double bytes_per_s = (ns > 0.0) ? (bytes * 1e9 / ns) : 0.0;
+    uint32_t cycles = (uint32_t)(cycles_per_byte * bytes);
+    printf("%-24s %10.1f ns/pkt %12.0f B/s %8u cyc (~%.1f us)\n",
+           name, ns, bytes_per_s, cycles, (double)cycles / M0P_CLOCK_MHZ);
+}
+
+static void check(const char *name, uint32_t hash, uint32_t golden)
+{
+    if (hash != golden)
+    {
+        printf("%-24s FAIL (0x%08x != 0x%08x)\n", name, hash, golden);
+        failures++;
+    }
+    else
+    {
+        printf("%-24s PASS\n", name);
+    }
+}
+
+static void bench_stages(uint32_t iterations)
+{
+    jv_ble_pdu pdu;
+    jv_ble_packet packet;
+    uint64_t start;
+    size_t coded_len;
+    uint32_t upscaled_len;
+
+    fill_payload(MAX_ADVERTISING_DATA_SIZE, 0x5a);
+    create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA), AdvData, sizeof(AdvData));
+
+    /* crc_update */
+    crc_t crc = crc_init();
+    start = now_ns();
+    for (uint32_t n = 0; n < iterations; n++)
+    {
+        crc = crc_update(crc_init(), pdu.pdu, pdu.pdu_len);
+        sink += crc;
+    }
+    report("crc_update", now_ns() - start, iterations, pdu.pdu_len, M0P_CYCLES_CRC);
+    check("crc_update", fnv1a(2166136261u, &(uint32_t){(uint32_t)crc}, sizeof(uint32_t)), GOLDEN_CRC);
+
+    /* whitening */
+    uint8_t lookup_table[WHITENING_SIZE];
+    uint8_t whitened[WHITENING_SIZE];
+    generate_whitening_lookup(lookup_table, 37, WHITENING_SIZE);
+    start = now_ns();
+    for (uint32_t n = 0; n < iterations; n++)
+    {
+        memcpy(whitened, pdu.pdu, pdu.pdu_len);
+        whiten(whitened, lookup_table, pdu.pdu_len);
+        sink += whitened[n % pdu.pdu_len];
+    }
+    report("whiten", now_ns() - start, iterations, pdu.pdu_len, M0P_CYCLES_WHITEN);
+    check("whiten", fnv1a(2166136261u, whitened, pdu.pdu_len), GOLDEN_WHITEN);
+
+    /* create_legacy_advertising_pdu */
+    start = now_ns();
+    for (uint32_t n = 0; n < iterations; n++)
+    {
+        AdvData[0] = (uint8_t)n;
+        create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA), AdvData, sizeof(AdvData));
+        sink += pdu.pdu[2];
+    }
+    report("create_legacy_adv_pdu", now_ns() - start, iterations, pdu.pdu_len, M0P_CYCLES_PDU);
+    AdvData[0] = 0x5a;
+    create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA), AdvData, sizeof(AdvData));
+    check("create_legacy_adv_pdu", fnv1a(2166136261u, pdu.pdu, pdu.pdu_len), GOLDEN_PDU);
+
+    /* encode_packet, S2 and S8 */
+    static const jv_packet_encoding_t coded[2] = {CODED_S2, CODED_S8};
+    static const uint32_t coded_golden[2] = {GOLDEN_ENCODE_S2, GOLDEN_ENCODE_S8};
+    static const uint32_t coded_cycles[2] = {M0P_CYCLES_FEC_S2, M0P_CYCLES_FEC_S8};
+    for (int k = 0; k < 2; k++)
+    {
+        char name[32];
+        init_packet(&packet, 0, &pdu, coded[k]);
+        start = now_ns();
+        for (uint32_t n = 0; n < iterations; n++)
+        {
+            coded_len = encode_packet(coded_buf, &packet);
+            sink += coded_buf[coded_len - 1];
+        }
+        snprintf(name, sizeof(name), "encode_packet %s", encoding_name[coded[k]]);
+        report(name, now_ns() - start, iterations, packet.packet_len, coded_cycles[k]);
+        check(name, fnv1a(2166136261u, coded_buf, coded_len), coded_golden[k]);
+    }
+
+    /* jv_bsc_upscale_1Mbps / jv_bsc_upscale_2Mbps */
+    init_packet(&packet, 0, &pdu, UNCODED_1MBPS);
+    start = now_ns();
+    for (uint32_t n = 0; n < iterations; n++)
+    {
+        upscaled_len = jv_bsc_upscale_1Mbps(upscaled_buf, packet.whitened_packet, packet.packet_len);
+        sink += upscaled_buf[n % packet.packet_len];
+    }
+    report("jv_bsc_upscale_1Mbps", now_ns() - start, iterations, packet.packet_len, M0P_CYCLES_UPSCALE1);
+    check("jv_bsc_upscale_1Mbps", fnv1a(2166136261u, upscaled_buf, upscaled_len), GOLDEN_UPSCALE_1M);
+
+    init_packet(&packet, 0, &pdu, UNCODED_2MBPS);
+    start = now_ns();
+    for (uint32_t n = 0; n < iterations; n++)
+    {
+        upscaled_len = jv_bsc_upscale_2Mbps(upscaled_buf, packet.whitened_packet, packet.packet_len);
+        sink += upscaled_buf[n % packet.packet_len];
+    }
+    report("jv_bsc_upscale_2Mbps", now_ns() - start, iterations, packet.packet_len, M0P_CYCLES_UPSCALE2);
+    check("jv_bsc_upscale_2Mbps", fnv1a(2166136261u, upscaled_buf, upscaled_len), GOLDEN_UPSCALE_2M);
+}
+
+static void check_airtime(void)
+{
+    jv_ble_pdu pdu;
+    jv_ble_packet packet;
+
+    fill_payload(EP_ADV_DATA_SIZE, 0x5a);
+    create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA), AdvData, EP_ADV_DATA_SIZE);
+    for (int encoding = UNCODED_1MBPS; encoding <= CODED_S8; encoding++)
+    {
+        char name[32];
+        uint32_t airtime;
+
+        init_packet(&packet, BENCH_BLE_CHANNEL, &pdu, (jv_packet_encoding_t)encoding);
+        airtime = packet_airtime_us(&packet);
+        snprintf(name, sizeof(name), "packet_airtime_us %s", encoding_name[encoding]);
+        if (airtime != GOLDEN_AIRTIME_US[encoding])
+        {
+            printf("%-24s FAIL (%u != %u us)\n", name, airtime, GOLDEN_AIRTIME_US[encoding]);
+            failures++;
+        }
+        else
+        {
+            printf("%-24s PASS\n", name);
+        }
+    }
+}
+
+/**
+ * @brief Run the per-packet pipeline (PDU, CRC/whitening, FEC, upscale) as the endpoints do
+ *
+ * @return uint32_t Size of the upscaled packet, in Bytes
+ */
+static uint32_t run_pipeline(jv_ble_pdu *pdu, jv_ble_packet *packet, uint8_t len)
+{
+    create_legacy_advertising_pdu(pdu, AdvA, sizeof(AdvA), AdvData, len);
+    update_advertising_packet(packet, pdu);
+    switch (packet->encoding)
+    {
+    case CODED_S2:
+    case CODED_S8:
+        return jv_bsc_upscale_1Mbps(upscaled_buf, coded_buf, encode_packet(coded_buf, packet));
+    case UNCODED_2MBPS:
+        return jv_bsc_upscale_2Mbps(upscaled_buf, packet->whitened_packet, packet->packet_len);
+    default:
+        return jv_bsc_upscale_1Mbps(upscaled_buf, packet->whitened_packet, packet->packet_len);
+    }
+}
+
+static uint32_t pipeline_cycles_per_byte(jv_packet_encoding_t encoding)
+{
+    switch (encoding)
+    {
+    case CODED_S2:
+        return M0P_CYCLES_PDU + M0P_CYCLES_CRC + M0P_CYCLES_WHITEN + M0P_CYCLES_FEC_S2 + 2 * M0P_CYCLES_UPSCALE1;
+    case CODED_S8:
+        return M0P_CYCLES_PDU + M0P_CYCLES_CRC + M0P_CYCLES_WHITEN + M0P_CYCLES_FEC_S8 + 8 * M0P_CYCLES_UPSCALE1;
+    case UNCODED_2MBPS:
+        return M0P_CYCLES_PDU + M0P_CYCLES_CRC + M0P_CYCLES_WHITEN + M0P_CYCLES_UPSCALE2;
+    default:
+        return M0P_CYCLES_PDU + M0P_CYCLES_CRC + M0P_CYCLES_WHITEN + M0P_CYCLES_UPSCALE1;
+    }
+}
+
+static void bench_pipeline(uint32_t iterations)
+{
+    jv_ble_pdu pdu;
+    jv_ble_packet packet;
+
+    for (int encoding = UNCODED_1MBPS; encoding <= CODED_S8; encoding++)
+    {
+        uint32_t hash = 2166136261u;
+        uint64_t total_ns = 0;
+        size_t total_bytes = 0;
+
+        for (uint8_t len = 0; len <= MAX_ADVERTISING_DATA_SIZE; len++)
+        {
+            char name[32];
+            uint32_t upscaled_len = 0;
+            uint64_t start;
+
+            fill_payload(len, len);
+            create_legacy_advertising_pdu(&pdu, AdvA, sizeof(AdvA), AdvData, len);
+            init_packet(&packet, BENCH_BLE_CHANNEL, &pdu, (jv_packet_encoding_t)encoding);
+
+            start = now_ns();
+            for (uint32_t n = 0; n < iterations; n++)
+            {
+                upscaled_len = run_pipeline(&pdu, &packet, len);
+                sink += upscaled_buf[0];
+            }
+            uint64_t elapsed = now_ns() - start;
+            total_ns += elapsed;
+            total_bytes += packet.packet_len;
+
+            hash = fnv1a(hash, upscaled_buf, upscaled_len);
+
+            if (len == 0 || len == EP_ADV_DATA_SIZE || len == MAX_ADVERTISING_DATA_SIZE)
+            {
+                snprintf(name, sizeof(name), "pipeline %s len %2u", encoding_name[encoding], len);
+                report(name, elapsed, iterations, packet.packet_len, pipeline_cycles_per_byte((jv_packet_encoding_t)encoding));
+            }
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "pipeline %s all lens", encoding_name[encoding]);
+        report(name, total_ns / (MAX_ADVERTISING_DATA_SIZE + 1), iterations,
+               total_bytes / (MAX_ADVERTISING_DATA_SIZE + 1), pipeline_cycles_per_byte((jv_packet_encoding_t)encoding));
+        check(name, hash, GOLDEN_PIPELINE[encoding]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    if (argc > 1)
+    {
+        iterations = (uint32_t)strtoul(argv[1], NULL, 0);
+        if (iterations == 0)
+            iterations = 1;
+    }
+
+    printf("%u iterations per measurement, M0+ estimate at %u MHz\n\n", iterations, M0P_CLOCK_MHZ);
+    bench_stages(iterations);
+    printf("\n");
+    check_airtime();
+    printf("\n");
+    bench_pipeline(iterations);
+
+    printf("\n%s\n", failures ? "GOLDEN CHECK FAILED" : "all golden checks passed");
+    return failures ? 1 : 0;
+}